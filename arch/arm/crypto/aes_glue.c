@@ -0,0 +1,358 @@
+/*
+ * Glue code for the ARM assembler AES implementation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Besides the plain cipher, which the generic mode templates pick up,
+ * cbc, ctr and xts are implemented here directly so that the per-block
+ * work is a call straight into the assembler code rather than through
+ * the cipher API.
+ */
+
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <crypto/aes.h>
+#include <crypto/algapi.h>
+#include <crypto/b128ops.h>
+#include <crypto/gf128mul.h>
+
+asmlinkage void aes_arm_encrypt(const u32 *rk, int rounds, const u8 *in,
+				u8 *out);
+asmlinkage void aes_arm_decrypt(const u32 *rk, int rounds, const u8 *in,
+				u8 *out);
+
+struct aes_arm_xts_ctx {
+	struct crypto_aes_ctx crypt;
+	struct crypto_aes_ctx tweak;
+};
+
+static inline int aes_arm_rounds(const struct crypto_aes_ctx *ctx)
+{
+	return 6 + ctx->key_length / 4;
+}
+
+/* Blocks are at least 32-bit aligned: all the algorithms use alignmask 3 */
+static inline void aes_arm_xor(u32 *dst, const u32 *a, const u32 *b)
+{
+	dst[0] = a[0] ^ b[0];
+	dst[1] = a[1] ^ b[1];
+	dst[2] = a[2] ^ b[2];
+	dst[3] = a[3] ^ b[3];
+}
+
+static void aes_encrypt(struct crypto_tfm *tfm, u8 *dst, const u8 *src)
+{
+	struct crypto_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	aes_arm_encrypt(ctx->key_enc, aes_arm_rounds(ctx), src, dst);
+}
+
+static void aes_decrypt(struct crypto_tfm *tfm, u8 *dst, const u8 *src)
+{
+	struct crypto_aes_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	aes_arm_decrypt(ctx->key_dec, aes_arm_rounds(ctx), src, dst);
+}
+
+static int cbc_encrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct crypto_aes_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	int rounds = aes_arm_rounds(ctx);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		u32 *iv = (u32 *)walk.iv;
+		u32 *s = (u32 *)walk.src.virt.addr;
+		u32 *d = (u32 *)walk.dst.virt.addr;
+
+		do {
+			aes_arm_xor(d, s, iv);
+			aes_arm_encrypt(ctx->key_enc, rounds, (u8 *)d, (u8 *)d);
+			iv = d;
+			s += AES_BLOCK_SIZE / 4;
+			d += AES_BLOCK_SIZE / 4;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+
+		memcpy(walk.iv, iv, AES_BLOCK_SIZE);
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	return err;
+}
+
+static int cbc_decrypt(struct blkcipher_desc *desc,
+		       struct scatterlist *dst, struct scatterlist *src,
+		       unsigned int nbytes)
+{
+	struct crypto_aes_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	int rounds = aes_arm_rounds(ctx);
+	struct blkcipher_walk walk;
+	u32 iv[AES_BLOCK_SIZE / 4];
+	u32 next[AES_BLOCK_SIZE / 4];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		u32 *s = (u32 *)walk.src.virt.addr;
+		u32 *d = (u32 *)walk.dst.virt.addr;
+
+		memcpy(iv, walk.iv, AES_BLOCK_SIZE);
+		do {
+			/* src and dst may be the same buffer */
+			memcpy(next, s, AES_BLOCK_SIZE);
+			aes_arm_decrypt(ctx->key_dec, rounds, (u8 *)s, (u8 *)d);
+			aes_arm_xor(d, d, iv);
+			memcpy(iv, next, AES_BLOCK_SIZE);
+			s += AES_BLOCK_SIZE / 4;
+			d += AES_BLOCK_SIZE / 4;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+
+		memcpy(walk.iv, iv, AES_BLOCK_SIZE);
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	return err;
+}
+
+static int ctr_crypt(struct blkcipher_desc *desc,
+		     struct scatterlist *dst, struct scatterlist *src,
+		     unsigned int nbytes)
+{
+	struct crypto_aes_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	int rounds = aes_arm_rounds(ctx);
+	struct blkcipher_walk walk;
+	u32 ks[AES_BLOCK_SIZE / 4];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes) >= AES_BLOCK_SIZE) {
+		u32 *s = (u32 *)walk.src.virt.addr;
+		u32 *d = (u32 *)walk.dst.virt.addr;
+
+		do {
+			aes_arm_encrypt(ctx->key_enc, rounds, walk.iv,
+					(u8 *)ks);
+			crypto_inc(walk.iv, AES_BLOCK_SIZE);
+			aes_arm_xor(d, s, ks);
+			s += AES_BLOCK_SIZE / 4;
+			d += AES_BLOCK_SIZE / 4;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	if (walk.nbytes) {
+		aes_arm_encrypt(ctx->key_enc, rounds, walk.iv, (u8 *)ks);
+		crypto_xor((u8 *)ks, walk.src.virt.addr, walk.nbytes);
+		memcpy(walk.dst.virt.addr, ks, walk.nbytes);
+		crypto_inc(walk.iv, AES_BLOCK_SIZE);
+		err = blkcipher_walk_done(desc, &walk, 0);
+	}
+
+	return err;
+}
+
+static int xts_set_key(struct crypto_tfm *tfm, const u8 *in_key,
+		       unsigned int key_len)
+{
+	struct aes_arm_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+	int err;
+
+	/* the key is the data key followed by the tweak key */
+	if (key_len % 2) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+
+	err = crypto_aes_expand_key(&ctx->crypt, in_key, key_len / 2);
+	if (!err)
+		err = crypto_aes_expand_key(&ctx->tweak, in_key + key_len / 2,
+					    key_len / 2);
+	if (err)
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+
+	return err;
+}
+
+static int xts_crypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		     struct scatterlist *src, unsigned int nbytes, bool enc)
+{
+	struct aes_arm_xts_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	const u32 *rk = enc ? ctx->crypt.key_enc : ctx->crypt.key_dec;
+	int rounds = aes_arm_rounds(&ctx->crypt);
+	struct blkcipher_walk walk;
+	be128 t;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+	if (!walk.nbytes)
+		return err;
+
+	/* T = E(K2, IV) */
+	aes_arm_encrypt(ctx->tweak.key_enc, aes_arm_rounds(&ctx->tweak),
+			walk.iv, (u8 *)&t);
+
+	while ((nbytes = walk.nbytes)) {
+		u32 *s = (u32 *)walk.src.virt.addr;
+		u32 *d = (u32 *)walk.dst.virt.addr;
+
+		do {
+			/* C = E(K1, P ^ T) ^ T, and likewise for decryption */
+			aes_arm_xor(d, s, (u32 *)&t);
+			if (enc)
+				aes_arm_encrypt(rk, rounds, (u8 *)d, (u8 *)d);
+			else
+				aes_arm_decrypt(rk, rounds, (u8 *)d, (u8 *)d);
+			aes_arm_xor(d, d, (u32 *)&t);
+			gf128mul_x_ble(&t, &t);
+			s += AES_BLOCK_SIZE / 4;
+			d += AES_BLOCK_SIZE / 4;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	return err;
+}
+
+static int xts_encrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int xts_decrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static struct crypto_alg aes_algs[] = { {
+	.cra_name		= "aes",
+	.cra_driver_name	= "aes-asm",
+	.cra_priority		= 200,
+	.cra_flags		= CRYPTO_ALG_TYPE_CIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct crypto_aes_ctx),
+	.cra_alignmask		= 3,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aes_algs[0].cra_list),
+	.cra_u	= {
+		.cipher	= {
+			.cia_min_keysize	= AES_MIN_KEY_SIZE,
+			.cia_max_keysize	= AES_MAX_KEY_SIZE,
+			.cia_setkey		= crypto_aes_set_key,
+			.cia_encrypt		= aes_encrypt,
+			.cia_decrypt		= aes_decrypt
+		}
+	}
+}, {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-asm",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct crypto_aes_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aes_algs[1].cra_list),
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= crypto_aes_set_key,
+			.encrypt	= cbc_encrypt,
+			.decrypt	= cbc_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "ctr(aes)",
+	.cra_driver_name	= "ctr-aes-asm",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct crypto_aes_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aes_algs[2].cra_list),
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= crypto_aes_set_key,
+			.encrypt	= ctr_crypt,
+			.decrypt	= ctr_crypt,
+		},
+	},
+}, {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "xts-aes-asm",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aes_arm_xts_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_list		= LIST_HEAD_INIT(aes_algs[3].cra_list),
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= xts_set_key,
+			.encrypt	= xts_encrypt,
+			.decrypt	= xts_decrypt,
+		},
+	},
+} };
+
+static int __init aes_init(void)
+{
+	int i, err;
+
+	for (i = 0; i < ARRAY_SIZE(aes_algs); i++) {
+		err = crypto_register_alg(&aes_algs[i]);
+		if (err)
+			goto unregister;
+	}
+	return 0;
+
+unregister:
+	while (--i >= 0)
+		crypto_unregister_alg(&aes_algs[i]);
+	return err;
+}
+
+static void __exit aes_fini(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(aes_algs) - 1; i >= 0; i--)
+		crypto_unregister_alg(&aes_algs[i]);
+}
+
+module_init(aes_init);
+module_exit(aes_fini);
+
+MODULE_DESCRIPTION("Rijndael (AES) Cipher Algorithm, ARM asm optimized");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("aes");
+MODULE_ALIAS("aes-asm");
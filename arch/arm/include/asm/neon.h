@@ -0,0 +1,34 @@
+/*
+ * arch/arm/include/asm/neon.h
+ *
+ * Kernel-mode NEON support.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+/*
+ * kernel_neon_begin() hands the NEON register file to the caller until
+ * the matching kernel_neon_end().  The state of the task owning the
+ * hardware context is saved first, so it is reloaded lazily on its
+ * next VFP/NEON instruction.  Preemption and softirqs stay disabled in
+ * between, so the section must not sleep; it may be entered from
+ * process or softirq context, but not from hardirq context.
+ *
+ * The NEON code itself should live in its own compilation unit or in
+ * inline assembly: the compiler must not be allowed to emit NEON
+ * instructions outside of such a section.
+ */
+extern void kernel_neon_begin(void);
+extern void kernel_neon_end(void);
+#endif
+
+#endif /* __ASM_ARM_NEON_H */
@@ -132,10 +132,99 @@ static struct xor_block_template xor_block_arm4regs = {
 	.do_5	= xor_arm4regs_5,
 };
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <linux/hardirq.h>
+#include <linux/irqflags.h>
+#include <asm/neon.h>
+
+/* arch/arm/lib/xor-neon.S; they need bytes to be a multiple of 64 */
+extern void xor_neon_2(unsigned long, unsigned long *, unsigned long *);
+extern void xor_neon_3(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *);
+extern void xor_neon_4(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *);
+extern void xor_neon_5(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *, unsigned long *);
+
+/*
+ * Kernel-mode NEON cannot be used from hardirq context; fall back to the
+ * integer code there.
+ */
+#define XOR_NEON_USABLE()	(!in_irq() && !irqs_disabled())
+
+static void
+xor_neon_do_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	if (!XOR_NEON_USABLE()) {
+		xor_arm4regs_2(bytes, p1, p2);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_2(bytes, p1, p2);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_do_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	      unsigned long *p3)
+{
+	if (!XOR_NEON_USABLE()) {
+		xor_arm4regs_3(bytes, p1, p2, p3);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_3(bytes, p1, p2, p3);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_do_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	      unsigned long *p3, unsigned long *p4)
+{
+	if (!XOR_NEON_USABLE()) {
+		xor_arm4regs_4(bytes, p1, p2, p3, p4);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_4(bytes, p1, p2, p3, p4);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_do_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+	      unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	if (!XOR_NEON_USABLE()) {
+		xor_arm4regs_5(bytes, p1, p2, p3, p4, p5);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_5(bytes, p1, p2, p3, p4, p5);
+	kernel_neon_end();
+}
+
+static struct xor_block_template xor_block_neon = {
+	.name	= "neon",
+	.do_2	= xor_neon_do_2,
+	.do_3	= xor_neon_do_3,
+	.do_4	= xor_neon_do_4,
+	.do_5	= xor_neon_do_5,
+};
+
+#define NEON_TEMPLATES					\
+	do {						\
+		if (cpu_has_neon())			\
+			xor_speed(&xor_block_neon);	\
+	} while (0)
+#else
+#define NEON_TEMPLATES	do { } while (0)
+#endif
+
 #undef XOR_TRY_TEMPLATES
 #define XOR_TRY_TEMPLATES			\
 	do {					\
 		xor_speed(&xor_block_arm4regs);	\
 		xor_speed(&xor_block_8regs);	\
 		xor_speed(&xor_block_32regs);	\
+		NEON_TEMPLATES;			\
 	} while (0)
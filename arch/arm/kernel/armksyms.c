@@ -49,6 +49,13 @@ extern void __aeabi_ulcmp(void);
 
 extern void fpundefinstr(void);
 
+extern void crc32_neon_fold(void);
+
+extern void xor_neon_2(void);
+extern void xor_neon_3(void);
+extern void xor_neon_4(void);
+extern void xor_neon_5(void);
+
 
 EXPORT_SYMBOL(__backtrace);
 
@@ -91,6 +98,19 @@ EXPORT_SYMBOL(memmove);
 EXPORT_SYMBOL(memchr);
 EXPORT_SYMBOL(__memzero);
 
+#ifdef CONFIG_CRC32_NEON
+	/* crc32 */
+EXPORT_SYMBOL(crc32_neon_fold);
+#endif
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+	/* xor_blocks */
+EXPORT_SYMBOL(xor_neon_2);
+EXPORT_SYMBOL(xor_neon_3);
+EXPORT_SYMBOL(xor_neon_4);
+EXPORT_SYMBOL(xor_neon_5);
+#endif
+
 	/* user mem (segment) */
 EXPORT_SYMBOL(__strnlen_user);
 EXPORT_SYMBOL(__strncpy_from_user);
@@ -107,9 +107,25 @@ static int tegra_quiesence_cpu(unsigned int cpunumber)
         return update_core_config(cpunumber, false);
 }
 
+/*
+ * On the LP cluster the request is recorded and served once the switch
+ * to G completes; a governor asking for a core is reason enough to
+ * switch, so force it rather than wait for the frequency to get there.
+ */
 static int tegra_wake_cpu(unsigned int cpunumber)
 {
-        return update_core_config(cpunumber, true);
+	int ret = update_core_config(cpunumber, true);
+
+	if (ret == -EBUSY && !no_lp) {
+		mutex_lock(tegra3_cpu_lock);
+		if (is_lp_cluster() && cpq_state != TEGRA_CPQ_DISABLED) {
+			cpq_state = TEGRA_CPQ_SWITCH_TO_G;
+			queue_delayed_work(cpuquiet_wq, &cpuquiet_work, 0);
+		}
+		mutex_unlock(tegra3_cpu_lock);
+	}
+
+	return ret;
 }
 
 static struct cpuquiet_driver tegra_cpuquiet_driver = {
@@ -0,0 +1,380 @@
+/*
+ *  linux/arch/arm/vfp/neon-selftest.c
+ *
+ *  Self test for kernel-mode NEON.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * A number of kernel threads, one more than there are CPUs so that they
+ * get preempted and migrated, repeatedly load the whole NEON register
+ * file with a per-thread pattern, spin on it inside a kernel_neon_begin()
+ * / kernel_neon_end() section and check the result.  A timer does the
+ * same from softirq context on whichever CPU it fires on.  When built
+ * in, a further thread takes the secondary CPUs offline and back online
+ * while this runs; as a module, CPU hotplug has to be driven from user
+ * space through /sys/devices/system/cpu/cpuN/online.
+ *
+ * A thread bound to CPU 0 also loads the registers the way a user task
+ * would, outside any NEON section, and holds them across a few ticks
+ * while a second timer and another bound thread use kernel-mode NEON on
+ * that CPU.  Its registers have to come back unchanged.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/timer.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+
+#include <asm/neon.h>
+#include <asm/vfp.h>
+
+#define NEON_WORDS	64	/* q0-q15 */
+#define NEON_LOOPS	64
+#define NEON_LIVE_CPU	0	/* never taken offline */
+
+static unsigned int duration_ms = 2000;
+module_param(duration_ms, uint, 0444);
+MODULE_PARM_DESC(duration_ms, "Length of the test in milliseconds");
+
+static unsigned int workers;
+module_param(workers, uint, 0444);
+MODULE_PARM_DESC(workers,
+		 "Number of test threads (default: online CPUs + 1)");
+
+static bool neon_stop;
+static atomic_t neon_passes = ATOMIC_INIT(0);
+static atomic_t neon_softirq_passes = ATOMIC_INIT(0);
+static atomic_t neon_failures = ATOMIC_INIT(0);
+static atomic_t neon_hotplug_events = ATOMIC_INIT(0);
+static atomic_t neon_live_passes = ATOMIC_INIT(0);
+static struct timer_list neon_timer;
+static struct timer_list neon_live_timer;
+
+/*
+ * Load buf into q0-q15, add q15 to each of q0-q14 'loops' times and
+ * store the registers back.
+ */
+static void neon_selftest_run(u32 *buf, unsigned int loops)
+{
+	u32 *p = buf;
+
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vldmia	%0!, {d0-d15}\n"
+	"	vldmia	%0, {d16-d31}\n"
+	"1:	vadd.i32	q0, q0, q15\n"
+	"	vadd.i32	q1, q1, q15\n"
+	"	vadd.i32	q2, q2, q15\n"
+	"	vadd.i32	q3, q3, q15\n"
+	"	vadd.i32	q4, q4, q15\n"
+	"	vadd.i32	q5, q5, q15\n"
+	"	vadd.i32	q6, q6, q15\n"
+	"	vadd.i32	q7, q7, q15\n"
+	"	vadd.i32	q8, q8, q15\n"
+	"	vadd.i32	q9, q9, q15\n"
+	"	vadd.i32	q10, q10, q15\n"
+	"	vadd.i32	q11, q11, q15\n"
+	"	vadd.i32	q12, q12, q15\n"
+	"	vadd.i32	q13, q13, q15\n"
+	"	vadd.i32	q14, q14, q15\n"
+	"	subs	%1, %1, #1\n"
+	"	bne	1b\n"
+	"	vstmia	%0, {d16-d31}\n"
+	"	sub	%0, %0, #128\n"
+	"	vstmia	%0, {d0-d15}\n"
+	: "+r" (p), "+r" (loops)
+	:
+	: "cc", "memory");
+}
+
+static inline u32 neon_pattern(u32 seed, unsigned int i)
+{
+	return seed ^ (i * 0x9e3779b9);
+}
+
+/* Returns true if the registers came back as expected. */
+static bool neon_selftest_check(u32 seed)
+{
+	u32 buf[NEON_WORDS];
+	unsigned int i;
+
+	for (i = 0; i < NEON_WORDS; i++)
+		buf[i] = neon_pattern(seed, i);
+
+	kernel_neon_begin();
+	neon_selftest_run(buf, NEON_LOOPS);
+	kernel_neon_end();
+
+	for (i = 0; i < NEON_WORDS; i++) {
+		u32 inc = neon_pattern(seed, NEON_WORDS - 4 + i % 4);
+		u32 want = neon_pattern(seed, i);
+
+		if (i < NEON_WORDS - 4)
+			want += NEON_LOOPS * inc;
+		if (buf[i] != want) {
+			pr_err("neon-selftest: seed %08x word %u: %08x != %08x\n",
+			       seed, i, buf[i], want);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void neon_timer_fn(unsigned long data)
+{
+	static u32 seed = 0x50f71e9;
+
+	if (neon_selftest_check(seed++))
+		atomic_inc(&neon_softirq_passes);
+	else
+		atomic_inc(&neon_failures);
+
+	if (!ACCESS_ONCE(neon_stop))
+		mod_timer(&neon_timer, jiffies + 1);
+}
+
+/*
+ * Fires on NEON_LIVE_CPU every tick so that the live thread bound there
+ * keeps getting interrupted by a kernel-mode NEON user.
+ */
+static void neon_live_timer_fn(unsigned long data)
+{
+	static u32 seed = 0x1fe0000;
+
+	if (neon_selftest_check(seed++))
+		atomic_inc(&neon_softirq_passes);
+	else
+		atomic_inc(&neon_failures);
+
+	if (!ACCESS_ONCE(neon_stop)) {
+		neon_live_timer.expires = jiffies + 1;
+		add_timer_on(&neon_live_timer, NEON_LIVE_CPU);
+	}
+}
+
+static void neon_live_load(const u32 *buf)
+{
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vldmia	%0!, {d0-d15}\n"
+	"	vldmia	%0, {d16-d31}\n"
+	: "+r" (buf)
+	:
+	: "memory");
+}
+
+static void neon_live_store(u32 *buf)
+{
+	asm volatile(
+	"	.fpu	neon\n"
+	"	vstmia	%0!, {d0-d15}\n"
+	"	vstmia	%0, {d16-d31}\n"
+	: "+r" (buf)
+	:
+	: "memory");
+}
+
+/*
+ * Keep a pattern live in d0-d31 across a couple of ticks without
+ * kernel_neon_begin(), so the lazy VFP switching code owns it just as
+ * it would a user task's, and check it survives.
+ */
+static int neon_live_fn(void *data)
+{
+	union vfp_state *vfp = &current_thread_info()->vfpstate;
+	u32 want[NEON_WORDS], got[NEON_WORDS];
+	u32 seed = 0x11e0000;
+	unsigned long end;
+	unsigned int i;
+
+	/*
+	 * Kernel threads inherit kthreadd's state, whose FPEXC has the
+	 * enable bit clear; start from a clean one the way exec does.
+	 */
+	memset(vfp, 0, sizeof(*vfp));
+	vfp->hard.fpexc = FPEXC_EN;
+#ifdef CONFIG_SMP
+	vfp->hard.cpu = NR_CPUS;	/* not loaded on any CPU */
+#endif
+
+	while (!kthread_should_stop()) {
+		for (i = 0; i < NEON_WORDS; i++)
+			want[i] = neon_pattern(seed, i);
+
+		neon_live_load(want);
+		end = jiffies + 2;
+		while (time_before(jiffies, end))
+			cond_resched();
+		neon_live_store(got);
+
+		if (memcmp(got, want, sizeof(want))) {
+			for (i = 0; i < NEON_WORDS; i++)
+				if (got[i] != want[i])
+					break;
+			pr_err("neon-selftest: live seed %08x word %u: "
+			       "%08x != %08x\n", seed, i, got[i], want[i]);
+			atomic_inc(&neon_failures);
+		} else
+			atomic_inc(&neon_live_passes);
+		seed++;
+	}
+	return 0;
+}
+
+static int neon_thread_fn(void *data)
+{
+	u32 seed = (unsigned long)data << 16;
+
+	while (!kthread_should_stop()) {
+		if (neon_selftest_check(seed++))
+			atomic_inc(&neon_passes);
+		else
+			atomic_inc(&neon_failures);
+		cond_resched();
+	}
+	return 0;
+}
+
+#ifndef MODULE
+static int neon_hotplug_fn(void *data)
+{
+	unsigned int cpu;
+
+	while (!kthread_should_stop()) {
+		for (cpu = 1; cpu < nr_cpu_ids; cpu++) {
+			if (kthread_should_stop())
+				break;
+			if (!cpu_online(cpu) || cpu_down(cpu))
+				continue;
+			msleep(20);
+			cpu_up(cpu);
+			msleep(20);
+		}
+		msleep(20);
+	}
+	return 0;
+}
+#endif
+
+static int __cpuinit neon_cpu_callback(struct notifier_block *nb,
+				       unsigned long action, void *hcpu)
+{
+	switch (action & ~CPU_TASKS_FROZEN) {
+	case CPU_ONLINE:
+	case CPU_DEAD:
+		atomic_inc(&neon_hotplug_events);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static struct notifier_block __cpuinitdata neon_cpu_notifier = {
+	.notifier_call = neon_cpu_callback,
+};
+
+static int __init neon_selftest_init(void)
+{
+	struct task_struct **threads;
+	struct task_struct *hotplug = NULL;
+	struct task_struct *live[2] = { NULL, NULL };
+	unsigned int i, n;
+	int ret = 0;
+
+	if (!cpu_has_neon()) {
+		pr_info("neon-selftest: no NEON, skipping\n");
+		return -ENODEV;
+	}
+
+	n = workers ? workers : num_online_cpus() + 1;
+	threads = kcalloc(n, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	register_hotcpu_notifier(&neon_cpu_notifier);
+
+	setup_timer(&neon_timer, neon_timer_fn, 0);
+	mod_timer(&neon_timer, jiffies + 1);
+	setup_timer(&neon_live_timer, neon_live_timer_fn, 0);
+	neon_live_timer.expires = jiffies + 1;
+	add_timer_on(&neon_live_timer, NEON_LIVE_CPU);
+
+	/* The live thread and a NEON section user, both on NEON_LIVE_CPU */
+	live[0] = kthread_create(neon_live_fn, NULL, "neon_selftest_live");
+	live[1] = kthread_create(neon_thread_fn, (void *)0xffffUL,
+				 "neon_selftest/live");
+	for (i = 0; i < ARRAY_SIZE(live); i++) {
+		if (IS_ERR(live[i])) {
+			ret = PTR_ERR(live[i]);
+			live[i] = NULL;
+			continue;
+		}
+		kthread_bind(live[i], NEON_LIVE_CPU);
+		wake_up_process(live[i]);
+	}
+
+	for (i = 0; !ret && i < n; i++) {
+		threads[i] = kthread_run(neon_thread_fn,
+					 (void *)(unsigned long)(i + 1),
+					 "neon_selftest/%u", i);
+		if (IS_ERR(threads[i])) {
+			ret = PTR_ERR(threads[i]);
+			threads[i] = NULL;
+			break;
+		}
+	}
+
+#ifndef MODULE
+	if (!ret && num_possible_cpus() > 1) {
+		hotplug = kthread_run(neon_hotplug_fn, NULL,
+				      "neon_selftest_hp");
+		if (IS_ERR(hotplug))
+			hotplug = NULL;
+	}
+#endif
+
+	if (!ret)
+		msleep(duration_ms);
+
+	if (hotplug)
+		kthread_stop(hotplug);
+	for (i = 0; i < n; i++)
+		if (threads[i])
+			kthread_stop(threads[i]);
+	for (i = 0; i < ARRAY_SIZE(live); i++)
+		if (live[i])
+			kthread_stop(live[i]);
+	neon_stop = true;
+	del_timer_sync(&neon_timer);
+	del_timer_sync(&neon_live_timer);
+	unregister_hotcpu_notifier(&neon_cpu_notifier);
+	kfree(threads);
+
+	if (ret)
+		return ret;
+
+	pr_info("neon-selftest: %d thread, %d softirq and %d live passes, "
+		"%d hotplug events, %d failures\n",
+		atomic_read(&neon_passes), atomic_read(&neon_softirq_passes),
+		atomic_read(&neon_live_passes),
+		atomic_read(&neon_hotplug_events),
+		atomic_read(&neon_failures));
+
+	return atomic_read(&neon_failures) ? -EINVAL : 0;
+}
+
+static void __exit neon_selftest_exit(void)
+{
+}
+
+module_init(neon_selftest_init);
+module_exit(neon_selftest_exit);
+
+MODULE_DESCRIPTION("Kernel-mode NEON self test");
+MODULE_LICENSE("GPL");
@@ -18,8 +18,10 @@
 #include <linux/sched.h>
 #include <linux/smp.h>
 #include <linux/init.h>
+#include <linux/interrupt.h>
 
 #include <asm/cputype.h>
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 #include <asm/cpu_pm.h>
@@ -120,6 +122,7 @@ static void vfp_thread_copy(struct thread_info *thread)
 static int vfp_notifier(struct notifier_block *self, unsigned long cmd, void *v)
 {
 	struct thread_info *thread = v;
+	unsigned long flags;
 	u32 fpexc;
 #ifdef CONFIG_SMP
 	unsigned int cpu;
@@ -127,6 +130,12 @@ static int vfp_notifier(struct notifier_block *self, unsigned long cmd, void *v)
 
 	switch (cmd) {
 	case THREAD_NOTIFY_SWITCH:
+		/*
+		 * Interrupts are enabled across the context switch, so keep
+		 * a softirq using kernel-mode NEON from saving the state
+		 * between our look at it and our own save.
+		 */
+		local_irq_save(flags);
 		fpexc = fmrx(FPEXC);
 
 #ifdef CONFIG_SMP
@@ -155,6 +164,7 @@ static int vfp_notifier(struct notifier_block *self, unsigned long cmd, void *v)
 		 * old state.
 		 */
 		fmxr(FPEXC, fpexc & ~FPEXC_EN);
+		local_irq_restore(flags);
 		break;
 
 	case THREAD_NOTIFY_FLUSH:
@@ -329,6 +339,15 @@ void VFP_bounce(u32 trigger, u32 fpexc, struct pt_regs *regs)
 {
 	u32 fpscr, orig_fpscr, fpsid, exceptions;
 
+	/*
+	 * We are entered with IRQs disabled so that nothing could touch
+	 * the hardware context while it was being switched in.  Keep
+	 * softirqs off while we emulate: a kernel-mode NEON user in a
+	 * softirq would otherwise save and disable the registers under us.
+	 */
+	local_bh_disable();
+	local_irq_enable();
+
 	pr_debug("VFP: bounce: trigger %08x fpexc %08x\n", trigger, fpexc);
 
 	/*
@@ -421,6 +440,7 @@ void VFP_bounce(u32 trigger, u32 fpexc, struct pt_regs *regs)
 	if (exceptions)
 		vfp_raise_exceptions(exceptions, trigger, orig_fpscr, regs);
  exit:
+	local_bh_enable();
 	preempt_enable();
 }
 
@@ -495,7 +515,11 @@ static inline void vfp_pm_init(void) { }
 
 void vfp_sync_hwstate(struct thread_info *thread)
 {
-	unsigned int cpu = get_cpu();
+	unsigned int cpu;
+
+	/* Keep softirq kernel-mode NEON users off the registers. */
+	local_bh_disable();
+	cpu = get_cpu();
 
 	/*
 	 * If the thread we're interested in is the current owner of the
@@ -513,6 +537,7 @@ void vfp_sync_hwstate(struct thread_info *thread)
 	}
 
 	put_cpu();
+	local_bh_enable();
 }
 
 void vfp_flush_hwstate(struct thread_info *thread)
@@ -548,6 +573,75 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+/*
+ * Is 'thread's most up to date state stored in this CPU's hardware?
+ * Must be called from non-preemptible context.
+ */
+static bool vfp_state_in_hw(unsigned int cpu, struct thread_info *thread)
+{
+#ifdef CONFIG_SMP
+	if (thread->vfpstate.hard.cpu != cpu)
+		return false;
+#endif
+	return vfp_current_hw_state[cpu] == &thread->vfpstate;
+}
+
+/*
+ * Kernel-side NEON support functions
+ */
+void kernel_neon_begin(void)
+{
+	unsigned int cpu;
+	u32 fpexc;
+
+	/*
+	 * Softirqs are disabled as well as preemption: a softirq using
+	 * NEON on top of a process context user would clobber its
+	 * registers, and the VFP undefined instruction handler relies on
+	 * nothing in softirq context touching the hardware state either.
+	 */
+	BUG_ON(in_irq());
+	local_bh_disable();
+	cpu = get_cpu();
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * Save the live user context, if any, and forget about the owner
+	 * so that its state is reloaded lazily the next time it touches
+	 * the VFP.  On UP the owner may be any thread.  On SMP the state
+	 * was already saved at the last context switch, and the registers
+	 * only hold something newer if they belong to current: another
+	 * owner may since have run, and been saved, on a different CPU.
+	 */
+#ifdef CONFIG_SMP
+	if (vfp_state_in_hw(cpu, current_thread_info()))
+		vfp_save_state(&current_thread_info()->vfpstate, fpexc);
+#else
+	if (vfp_current_hw_state[cpu])
+		vfp_save_state(vfp_current_hw_state[cpu], fpexc);
+#endif
+	vfp_current_hw_state[cpu] = NULL;
+
+	/* Drop any exception state the owner left behind. */
+	fmxr(FPEXC, FPEXC_EN);
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the NEON/VFP unit. */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	put_cpu();
+	local_bh_enable();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 /*
  * VFP hardware can lose all context when a CPU goes offline.
  * As we will be running in SMP mode with CPU hotplug, we will save the
@@ -649,4 +743,11 @@ static int __init vfp_init(void)
 	return 0;
 }
 
-late_initcall(vfp_init);
+/*
+ * HWCAP_NEON must be set before calibrate_xor_blocks() (a core_initcall
+ * in crypto/) and raid6_select_algo() (subsys_initcall) pick their
+ * routines. The raid6 case is ordered by level, but the xor one is not:
+ * within core_initcall we rely on arch/arm/vfp/ being linked ahead of
+ * crypto/. A later level such as arch_initcall would be too late.
+ */
+core_initcall(vfp_init);
@@ -26,6 +26,7 @@
 #include <linux/compiler.h>
 #include <linux/blktrace_api.h>
 #include <linux/jiffies.h>
+#include <linux/math64.h>
 
 /*
  * enum row_queue_prio - Priorities of the ROW queues
@@ -85,6 +86,30 @@ static const struct row_queue_params row_queues_def[] = {
 #define ROW_IDLE_TIME_MSEC 5	/* msec */
 #define ROW_READ_FREQ_MSEC 20	/* msec */
 
+/* Default values and limits for adaptive tuning */
+#define ROW_ADAPT_READ_TARGET_USEC	20000	/* usec */
+#define ROW_ADAPT_WINDOW_MSEC		200	/* msec */
+#define ROW_ADAPT_MAX_QUANTUM		64	/* requests */
+#define ROW_ADAPT_MAX_IDLE_MSEC		20	/* msec */
+
+/* Latency histogram buckets: [0] < 1us, [i] < 2^i us, last is open ended */
+#define ROW_LAT_BUCKETS 20
+
+/**
+ * struct row_lat_hist - latency histogram
+ * @count:	number of samples
+ * @max_us:	largest sample (usec)
+ * @total_us:	sum of all samples (usec)
+ * @buckets:	log2 histogram of samples
+ *
+ */
+struct row_lat_hist {
+	u32			count;
+	u32			max_us;
+	u64			total_us;
+	u32			buckets[ROW_LAT_BUCKETS];
+};
+
 /**
  * struct rowq_idling_data -  parameters for idling on the queue
  * @last_insert_time:	time the last request was inserted
@@ -109,6 +134,8 @@ struct rowq_idling_data {
  * @dispatch quantum:	number of requests this queue may
  *			dispatch in a dispatch cycle
  * @idle_data:		data for idling on queues
+ * @disp_lat:		insertion to dispatch latency histogram
+ * @compl_lat:		dispatch to completion latency histogram
  *
  */
 struct row_queue {
@@ -124,6 +151,9 @@ struct row_queue {
 
 	/* used only for READ queues */
 	struct rowq_idling_data	idle_data;
+
+	struct row_lat_hist	disp_lat;
+	struct row_lat_hist	compl_lat;
 };
 
 /**
@@ -142,6 +172,33 @@ struct idling_data {
 	struct delayed_work		idle_work;
 };
 
+/**
+ * struct row_adapt_data - state of the adaptive tuning mode
+ * @enabled:		adaptive tuning is on
+ * @read_target_us:	read latency (insertion to completion) to keep
+ *			the read queues under (usec)
+ * @window:		length of an evaluation window (jiffies)
+ * @window_start:	start of the current window (jiffies)
+ * @read_total_us:	sum of read latencies in the current window
+ * @read_count:		number of reads completed in the current window
+ * @last_read_lat_us:	average read latency of the last window
+ * @base_quantum:	quantums at the time adaptive mode was enabled
+ * @base_idle_time:	read idle time at the time adaptive mode was
+ *			enabled
+ *
+ */
+struct row_adapt_data {
+	bool			enabled;
+	u32			read_target_us;
+	unsigned long		window;
+	unsigned long		window_start;
+	u64			read_total_us;
+	u32			read_count;
+	u32			last_read_lat_us;
+	int			base_quantum[ROWQ_MAX_PRIO];
+	unsigned long		base_idle_time;
+};
+
 /**
  * struct row_queue - Per block device rqueue structure
  * @dispatch_queue:	dispatch rqueue
@@ -153,6 +210,7 @@ struct idling_data {
  *			scheduler, nr_reqs[1] holds the number of all WRITE
  *			requests in scheduler
  * @cycle_flags:	used for marking unserved queueus
+ * @adapt:		adaptive quantum and idle time tuning
  *
  */
 struct row_data {
@@ -166,9 +224,16 @@ struct row_data {
 	unsigned int			nr_reqs[2];
 
 	unsigned int			cycle_flags;
+
+	struct row_adapt_data		adapt;
 };
 
 #define RQ_ROWQ(rq) ((struct row_queue *) ((rq)->elevator_private[0]))
+/* insertion and dispatch times of a request, in usec (truncated) */
+#define RQ_INSERT_US(rq) ((unsigned long)((rq)->elevator_private[1]))
+#define RQ_DISPATCH_US(rq) ((unsigned long)((rq)->elevator_private[2]))
+#define RQ_SET_INSERT_US(rq, us) ((rq)->elevator_private[1] = (void *)(us))
+#define RQ_SET_DISPATCH_US(rq, us) ((rq)->elevator_private[2] = (void *)(us))
 
 #define row_log(q, fmt, args...)   \
 	blk_add_trace_msg(q, "%s():" fmt , __func__, ##args)
@@ -207,6 +272,96 @@ static inline void __maybe_unused row_dump_queues_stat(struct row_data *rd)
 }
 
 /******************** Static helper functions ***********************/
+static inline unsigned long row_now_us(void)
+{
+	return (unsigned long)ktime_to_us(ktime_get());
+}
+
+static void row_lat_add(struct row_lat_hist *hist, unsigned long us)
+{
+	hist->count++;
+	hist->total_us += us;
+	if (us > hist->max_us)
+		hist->max_us = us;
+	hist->buckets[min_t(int, fls_long(us), ROW_LAT_BUCKETS - 1)]++;
+}
+
+static inline bool row_is_write_queue(enum row_queue_prio prio)
+{
+	return prio == ROWQ_PRIO_HIGH_SWRITE || prio == ROWQ_PRIO_REG_SWRITE ||
+		prio == ROWQ_PRIO_REG_WRITE || prio == ROWQ_PRIO_LOW_SWRITE;
+}
+
+/*
+ * row_adapt_update() - Re-tune quantums and idling at the end of a window
+ * @rd:	pointer to struct row_data
+ *
+ * If reads on the high and regular priority read queues took longer than
+ * the target on average, halve the write quantums and idle longer on
+ * reads. If they stayed under half the target, or there were no reads at
+ * all, grow the write quantums by one and idle less, letting writes go out
+ * in bigger batches.
+ */
+static void row_adapt_update(struct row_data *rd)
+{
+	struct row_adapt_data *ad = &rd->adapt;
+	unsigned long max_idle = msecs_to_jiffies(ROW_ADAPT_MAX_IDLE_MSEC);
+	int i;
+
+	ad->last_read_lat_us = ad->read_count ?
+		div_u64(ad->read_total_us, ad->read_count) : 0;
+	ad->read_total_us = 0;
+	ad->read_count = 0;
+	ad->window_start = jiffies;
+
+	if (ad->last_read_lat_us > ad->read_target_us) {
+		for (i = 0; i < ROWQ_MAX_PRIO; i++)
+			if (row_is_write_queue(i))
+				rd->row_queues[i].disp_quantum =
+				    max(rd->row_queues[i].disp_quantum / 2, 1);
+		if (rd->read_idle.idle_time < max_idle)
+			rd->read_idle.idle_time++;
+	} else if (ad->last_read_lat_us < ad->read_target_us / 2) {
+		for (i = 0; i < ROWQ_MAX_PRIO; i++)
+			if (row_is_write_queue(i) &&
+			    rd->row_queues[i].disp_quantum <
+			    ROW_ADAPT_MAX_QUANTUM)
+				rd->row_queues[i].disp_quantum++;
+		if (rd->read_idle.idle_time > 1)
+			rd->read_idle.idle_time--;
+	}
+
+	row_log(rd->dispatch_queue, "adapt: read lat %uus, write quantum %d",
+		ad->last_read_lat_us,
+		rd->row_queues[ROWQ_PRIO_REG_WRITE].disp_quantum);
+}
+
+static void row_adapt_start(struct row_data *rd)
+{
+	struct row_adapt_data *ad = &rd->adapt;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		ad->base_quantum[i] = rd->row_queues[i].disp_quantum;
+	ad->base_idle_time = rd->read_idle.idle_time;
+	ad->read_total_us = 0;
+	ad->read_count = 0;
+	ad->last_read_lat_us = 0;
+	ad->window_start = jiffies;
+	ad->enabled = true;
+}
+
+static void row_adapt_stop(struct row_data *rd)
+{
+	struct row_adapt_data *ad = &rd->adapt;
+	int i;
+
+	ad->enabled = false;
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		rd->row_queues[i].disp_quantum = ad->base_quantum[i];
+	rd->read_idle.idle_time = ad->base_idle_time;
+}
+
 /*
  * kick_queue() - Wake up device driver queue thread
  * @work:	pointer to struct work_struct
@@ -281,6 +436,7 @@ static void row_add_request(struct request_queue *q,
 	rd->nr_reqs[rq_data_dir(rq)]++;
 	rqueue->nr_req++;
 	rq_set_fifo_time(rq, jiffies); /* for statistics*/
+	RQ_SET_INSERT_US(rq, row_now_us());
 
 	if (row_queues_def[rqueue->prio].idling_enabled) {
 		if (delayed_work_pending(&rd->read_idle.idle_work))
@@ -393,8 +549,12 @@ static void row_remove_request(struct request_queue *q,
 static void row_dispatch_insert(struct row_data *rd)
 {
 	struct request *rq;
+	unsigned long now = row_now_us();
 
 	rq = rq_entry_fifo(rd->row_queues[rd->curr_queue].fifo.next);
+	row_lat_add(&rd->row_queues[rd->curr_queue].disp_lat,
+		    now - RQ_INSERT_US(rq));
+	RQ_SET_DISPATCH_US(rq, now);
 	row_remove_request(rd->dispatch_queue, rq);
 	elv_dispatch_add_tail(rd->dispatch_queue, rq);
 	rd->row_queues[rd->curr_queue].nr_dispatched++;
@@ -403,6 +563,33 @@ static void row_dispatch_insert(struct row_data *rd)
 		     rd->row_queues[rd->curr_queue].nr_dispatched);
 }
 
+/*
+ * row_completed_request() - Account a completed request
+ * @q:	requests queue
+ * @rq:	request that completed
+ *
+ */
+static void row_completed_request(struct request_queue *q,
+				  struct request *rq)
+{
+	struct row_data *rd = q->elevator->elevator_data;
+	struct row_queue *rqueue = RQ_ROWQ(rq);
+	unsigned long now = row_now_us();
+
+	row_lat_add(&rqueue->compl_lat, now - RQ_DISPATCH_US(rq));
+
+	if (!rd->adapt.enabled)
+		return;
+
+	if (rqueue->prio == ROWQ_PRIO_HIGH_READ ||
+	    rqueue->prio == ROWQ_PRIO_REG_READ) {
+		rd->adapt.read_total_us += now - RQ_INSERT_US(rq);
+		rd->adapt.read_count++;
+	}
+	if (time_after_eq(jiffies, rd->adapt.window_start + rd->adapt.window))
+		row_adapt_update(rd);
+}
+
 /*
  * row_choose_queue() -  choose the next queue to dispatch from
  * @rd:	pointer to struct row_data
@@ -562,6 +749,8 @@ static void *row_init_queue(struct request_queue *q)
 	if (!rdata->read_idle.idle_time)
 		rdata->read_idle.idle_time = 1;
 	rdata->read_idle.freq = ROW_READ_FREQ_MSEC;
+	rdata->adapt.read_target_us = ROW_ADAPT_READ_TARGET_USEC;
+	rdata->adapt.window = msecs_to_jiffies(ROW_ADAPT_WINDOW_MSEC);
 	rdata->read_idle.idle_workqueue = alloc_workqueue("row_idle_work",
 					    WQ_MEM_RECLAIM | WQ_HIGHPRI, 0);
 	if (!rdata->read_idle.idle_workqueue)
@@ -664,7 +853,7 @@ static ssize_t row_var_show(int var, char *page)
 static ssize_t row_var_store(int *var, const char *page, size_t count)
 {
 	int err;
-	err = kstrtoul(page, 10, (unsigned long *)var);
+	err = kstrtoint(page, 10, var);
 
 	return count;
 }
@@ -737,9 +926,141 @@ STORE_FUNCTION(row_read_idle_freq_store, &rowd->read_idle.freq, 1, INT_MAX, 0);
 
 #undef STORE_FUNCTION
 
+static const char * const row_queue_names[] = {
+	"hp_read", "rp_read", "hp_swrite", "rp_swrite",
+	"rp_write", "lp_read", "lp_swrite",
+};
+
+static ssize_t row_lat_hist_show(struct row_data *rowd, char *page,
+				 size_t offset)
+{
+	ssize_t len = 0;
+	int i, j;
+
+	len += scnprintf(page + len, PAGE_SIZE - len,
+			 "queue count avg_us max_us "
+			 "hist(<1us,<2us,<4us,...)\n");
+	for (i = 0; i < ROWQ_MAX_PRIO; i++) {
+		struct row_lat_hist *hist =
+			(void *)&rowd->row_queues[i] + offset;
+
+		len += scnprintf(page + len, PAGE_SIZE - len, "%s %u %llu %u",
+				 row_queue_names[i], hist->count,
+				 hist->count ? div_u64(hist->total_us,
+						       hist->count) : 0ULL,
+				 hist->max_us);
+		for (j = 0; j < ROW_LAT_BUCKETS; j++)
+			len += scnprintf(page + len, PAGE_SIZE - len, " %u",
+					 hist->buckets[j]);
+		len += scnprintf(page + len, PAGE_SIZE - len, "\n");
+	}
+
+	return len;
+}
+
+static ssize_t row_dispatch_lat_show(struct elevator_queue *e, char *page)
+{
+	return row_lat_hist_show(e->elevator_data, page,
+				 offsetof(struct row_queue, disp_lat));
+}
+
+static ssize_t row_completion_lat_show(struct elevator_queue *e, char *page)
+{
+	return row_lat_hist_show(e->elevator_data, page,
+				 offsetof(struct row_queue, compl_lat));
+}
+
+static ssize_t row_effective_params_show(struct elevator_queue *e,
+					 char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < ROWQ_MAX_PRIO; i++)
+		len += scnprintf(page + len, PAGE_SIZE - len, "%s_quantum %d\n",
+				 row_queue_names[i],
+				 rowd->row_queues[i].disp_quantum);
+	len += scnprintf(page + len, PAGE_SIZE - len,
+			 "read_idle %u\nadaptive %d\nread_lat_us %u\n",
+			 jiffies_to_msecs(rowd->read_idle.idle_time),
+			 rowd->adapt.enabled, rowd->adapt.last_read_lat_us);
+
+	return len;
+}
+
+static ssize_t row_adaptive_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+
+	return row_var_show(rowd->adapt.enabled, page);
+}
+
+static ssize_t row_adaptive_store(struct elevator_queue *e,
+				  const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	spinlock_t *lock = rowd->dispatch_queue->queue_lock;
+	int enable;
+
+	if (kstrtoint(page, 10, &enable))
+		return -EINVAL;
+
+	spin_lock_irq(lock);
+	if (enable && !rowd->adapt.enabled)
+		row_adapt_start(rowd);
+	else if (!enable && rowd->adapt.enabled)
+		row_adapt_stop(rowd);
+	spin_unlock_irq(lock);
+
+	return count;
+}
+
+static ssize_t row_read_lat_target_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+
+	return row_var_show(rowd->adapt.read_target_us, page);
+}
+
+static ssize_t row_read_lat_target_store(struct elevator_queue *e,
+					 const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int target;
+
+	if (kstrtoint(page, 10, &target))
+		return -EINVAL;
+	rowd->adapt.read_target_us = max(target, 1);
+
+	return count;
+}
+
+static ssize_t row_adapt_window_show(struct elevator_queue *e, char *page)
+{
+	struct row_data *rowd = e->elevator_data;
+
+	return row_var_show(jiffies_to_msecs(rowd->adapt.window), page);
+}
+
+static ssize_t row_adapt_window_store(struct elevator_queue *e,
+				      const char *page, size_t count)
+{
+	struct row_data *rowd = e->elevator_data;
+	int window;
+
+	if (kstrtoint(page, 10, &window))
+		return -EINVAL;
+	rowd->adapt.window = max(msecs_to_jiffies(max(window, 1)), 1UL);
+
+	return count;
+}
+
 #define ROW_ATTR(name) \
 	__ATTR(name, S_IRUGO|S_IWUSR, row_##name##_show, \
 				      row_##name##_store)
+#define ROW_ATTR_RO(name) \
+	__ATTR(name, S_IRUGO, row_##name##_show, NULL)
 
 static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(hp_read_quantum),
@@ -751,6 +1072,12 @@ static struct elv_fs_entry row_attrs[] = {
 	ROW_ATTR(lp_swrite_quantum),
 	ROW_ATTR(read_idle),
 	ROW_ATTR(read_idle_freq),
+	ROW_ATTR(adaptive),
+	ROW_ATTR(read_lat_target),
+	ROW_ATTR(adapt_window),
+	ROW_ATTR_RO(dispatch_lat),
+	ROW_ATTR_RO(completion_lat),
+	ROW_ATTR_RO(effective_params),
 	__ATTR_NULL
 };
 
@@ -760,6 +1087,7 @@ static struct elevator_type iosched_row = {
 		.elevator_dispatch_fn		= row_dispatch_requests,
 		.elevator_add_req_fn		= row_add_request,
 		.elevator_reinsert_req_fn	= row_reinsert_req,
+		.elevator_completed_req_fn	= row_completed_request,
 		.elevator_is_urgent_fn		= row_urgent_pending,
 		.elevator_former_req_fn		= elv_rb_former_request,
 		.elevator_latter_req_fn		= elv_rb_latter_request,
@@ -5,19 +5,26 @@
  * Copyright (C) 2012 Miguel Boton <mboton@gmail.com>
  *
  *
- * This algorithm does not do any kind of sorting, as it is aimed for
+ * By default this algorithm does not sort dispatches, as it is aimed for
  * aleatory access devices, but it does some basic merging. We try to
  * keep minimum overhead to achieve low latency.
  *
  * Asynchronous and synchronous requests are not treated separately, but
  * we relay on deadlines to ensure fairness.
  *
+ * Requests are also kept in a sector sorted tree per direction, used for
+ * front merges. With the 'sort' tunable set, a batch started from the fifo
+ * continues in ascending sector order for up to fifo_batch requests, which
+ * helps devices that still care about locality (eMMC writes, SD cards).
+ * Expired requests are checked between batches as before.
+ *
  */
 #include <linux/blkdev.h>
 #include <linux/elevator.h>
 #include <linux/bio.h>
 #include <linux/module.h>
 #include <linux/init.h>
+#include <linux/rbtree.h>
 #include <linux/version.h>
 
 enum { ASYNC, SYNC };
@@ -32,22 +39,83 @@ static const int async_write_expire = 16 * HZ;	/* ditto for async, these limits
 static const int writes_starved = 2;		/* max times reads can starve a write */
 static const int fifo_batch     = 8;		/* # of sequential requests treated as one
 						   by the above parameters. For throughput. */
+static const int sort           = 0;		/* dispatch batches in sector order */
 
 /* Elevator data */
 struct sio_data {
 	/* Request queues */
 	struct list_head fifo_list[2][2];
+	struct rb_root sort_list[2];
 
 	/* Attributes */
 	unsigned int batched;
 	unsigned int starved;
+	struct request *next_rq[2];
+	int batch_dir;
 
 	/* Settings */
 	int fifo_expire[2][2];
 	int fifo_batch;
 	int writes_starved;
+	int sort;
 };
 
+static inline struct request *
+sio_latter_rq(struct request *rq)
+{
+	struct rb_node *node = rb_next(&rq->rb_node);
+
+	if (node)
+		return rb_entry_rq(node);
+
+	return NULL;
+}
+
+static void
+sio_remove_request(struct sio_data *sd, struct request *rq)
+{
+	const int data_dir = rq_data_dir(rq);
+
+	/* Keep the sorted batch going past a request that goes away */
+	if (sd->next_rq[data_dir] == rq)
+		sd->next_rq[data_dir] = sio_latter_rq(rq);
+
+	rq_fifo_clear(rq);
+	elv_rb_del(&sd->sort_list[data_dir], rq);
+}
+
+static int
+sio_merge(struct request_queue *q, struct request **req, struct bio *bio)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+	sector_t sector = bio->bi_sector + bio_sectors(bio);
+	struct request *__rq;
+
+	/*
+	 * Check for a front merge; back merges are found by the
+	 * elevator core through its request hash.
+	 */
+	__rq = elv_rb_find(&sd->sort_list[bio_data_dir(bio)], sector);
+	if (__rq && elv_rq_merge_ok(__rq, bio)) {
+		*req = __rq;
+		return ELEVATOR_FRONT_MERGE;
+	}
+
+	return ELEVATOR_NO_MERGE;
+}
+
+static void
+sio_merged_request(struct request_queue *q, struct request *rq, int type)
+{
+	struct sio_data *sd = q->elevator->elevator_data;
+
+	/* A front merge moves the start sector, reposition the request */
+	if (type == ELEVATOR_FRONT_MERGE) {
+		elv_rb_del(&sd->sort_list[rq_data_dir(rq)], rq);
+		elv_rb_add(&sd->sort_list[rq_data_dir(rq)], rq);
+	}
+}
+
 static void
 sio_merged_requests(struct request_queue *q, struct request *rq,
 		    struct request *next)
@@ -64,7 +132,7 @@ sio_merged_requests(struct request_queue *q, struct request *rq,
 	}
 
 	/* Delete next request */
-	rq_fifo_clear(next);
+	sio_remove_request(q->elevator->elevator_data, next);
 }
 
 static void
@@ -80,6 +148,7 @@ sio_add_request(struct request_queue *q, struct request *rq)
 	 */
 	rq_set_fifo_time(rq, jiffies + sd->fifo_expire[sync][data_dir]);
 	list_add_tail(&rq->queuelist, &sd->fifo_list[sync][data_dir]);
+	elv_rb_add(&sd->sort_list[data_dir], rq);
 }
 
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
@@ -167,11 +236,18 @@ sio_choose_request(struct sio_data *sd, int data_dir)
 static inline void
 sio_dispatch_request(struct sio_data *sd, struct request *rq)
 {
+	const int data_dir = rq_data_dir(rq);
+
 	/*
-	 * Remove the request from the fifo list
-	 * and dispatch it.
+	 * Remember where a sorted batch would continue, then remove
+	 * the request from the fifo list and sort tree and dispatch it.
 	 */
-	rq_fifo_clear(rq);
+	sd->next_rq[READ] = NULL;
+	sd->next_rq[WRITE] = NULL;
+	sd->next_rq[data_dir] = sio_latter_rq(rq);
+	sd->batch_dir = data_dir;
+
+	sio_remove_request(sd, rq);
 	elv_dispatch_add_tail(rq->q, rq);
 
 	sd->batched++;
@@ -198,6 +274,10 @@ sio_dispatch_requests(struct request_queue *q, int force)
 		rq = sio_choose_expired_request(sd);
 	}
 
+	/* Continue a sorted batch in ascending sector order */
+	if (!rq && sd->sort && sd->batched)
+		rq = sd->next_rq[sd->batch_dir];
+
 	/* Retrieve request */
 	if (!rq) {
 		if (sd->starved > sd->writes_starved)
@@ -214,34 +294,6 @@ sio_dispatch_requests(struct request_queue *q, int force)
 	return 1;
 }
 
-static struct request *
-sio_former_request(struct request_queue *q, struct request *rq)
-{
-	struct sio_data *sd = q->elevator->elevator_data;
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
-
-	if (rq->queuelist.prev == &sd->fifo_list[sync][data_dir])
-		return NULL;
-
-	/* Return former request */
-	return list_entry(rq->queuelist.prev, struct request, queuelist);
-}
-
-static struct request *
-sio_latter_request(struct request_queue *q, struct request *rq)
-{
-	struct sio_data *sd = q->elevator->elevator_data;
-	const int sync = rq_is_sync(rq);
-	const int data_dir = rq_data_dir(rq);
-
-	if (rq->queuelist.next == &sd->fifo_list[sync][data_dir])
-		return NULL;
-
-	/* Return latter request */
-	return list_entry(rq->queuelist.next, struct request, queuelist);
-}
-
 static void *
 sio_init_queue(struct request_queue *q)
 {
@@ -257,14 +309,22 @@ sio_init_queue(struct request_queue *q)
 	INIT_LIST_HEAD(&sd->fifo_list[SYNC][WRITE]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][READ]);
 	INIT_LIST_HEAD(&sd->fifo_list[ASYNC][WRITE]);
+	sd->sort_list[READ] = RB_ROOT;
+	sd->sort_list[WRITE] = RB_ROOT;
 
 	/* Initialize data */
 	sd->batched = 0;
+	sd->starved = 0;
+	sd->next_rq[READ] = NULL;
+	sd->next_rq[WRITE] = NULL;
+	sd->batch_dir = READ;
 	sd->fifo_expire[SYNC][READ] = sync_read_expire;
 	sd->fifo_expire[SYNC][WRITE] = sync_write_expire;
 	sd->fifo_expire[ASYNC][READ] = async_read_expire;
 	sd->fifo_expire[ASYNC][WRITE] = async_write_expire;
 	sd->fifo_batch = fifo_batch;
+	sd->writes_starved = writes_starved;
+	sd->sort = sort;
 
 	return sd;
 }
@@ -317,6 +377,7 @@ SHOW_FUNCTION(sio_async_read_expire_show, sd->fifo_expire[ASYNC][READ], 1);
 SHOW_FUNCTION(sio_async_write_expire_show, sd->fifo_expire[ASYNC][WRITE], 1);
 SHOW_FUNCTION(sio_fifo_batch_show, sd->fifo_batch, 0);
 SHOW_FUNCTION(sio_writes_starved_show, sd->writes_starved, 0);
+SHOW_FUNCTION(sio_sort_show, sd->sort, 0);
 #undef SHOW_FUNCTION
 
 #define STORE_FUNCTION(__FUNC, __PTR, MIN, MAX, __CONV)			\
@@ -341,6 +402,7 @@ STORE_FUNCTION(sio_async_read_expire_store, &sd->fifo_expire[ASYNC][READ], 0, IN
 STORE_FUNCTION(sio_async_write_expire_store, &sd->fifo_expire[ASYNC][WRITE], 0, INT_MAX, 1);
 STORE_FUNCTION(sio_fifo_batch_store, &sd->fifo_batch, 0, INT_MAX, 0);
 STORE_FUNCTION(sio_writes_starved_store, &sd->writes_starved, 0, INT_MAX, 0);
+STORE_FUNCTION(sio_sort_store, &sd->sort, 0, 1, 0);
 #undef STORE_FUNCTION
 
 #define DD_ATTR(name) \
@@ -354,19 +416,22 @@ static struct elv_fs_entry sio_attrs[] = {
 	DD_ATTR(async_write_expire),
 	DD_ATTR(fifo_batch),
 	DD_ATTR(writes_starved),
+	DD_ATTR(sort),
 	__ATTR_NULL
 };
 
 static struct elevator_type iosched_sio = {
 	.ops = {
+		.elevator_merge_fn		= sio_merge,
+		.elevator_merged_fn		= sio_merged_request,
 		.elevator_merge_req_fn		= sio_merged_requests,
 		.elevator_dispatch_fn		= sio_dispatch_requests,
 		.elevator_add_req_fn		= sio_add_request,
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2,6,38)
 		.elevator_queue_empty_fn	= sio_queue_empty,
 #endif
-		.elevator_former_req_fn		= sio_former_request,
-		.elevator_latter_req_fn		= sio_latter_request,
+		.elevator_former_req_fn		= elv_rb_former_request,
+		.elevator_latter_req_fn		= elv_rb_latter_request,
 		.elevator_init_fn		= sio_init_queue,
 		.elevator_exit_fn		= sio_exit_queue,
 	},
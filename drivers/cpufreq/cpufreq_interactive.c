@@ -27,13 +27,38 @@
 #include <linux/workqueue.h>
 #include <linux/kthread.h>
 #include <linux/mutex.h>
+#include <linux/input.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
 
 #include <asm/cputime.h>
+#include <asm/div64.h>
+
+#if defined(CONFIG_INPUT) || (defined(CONFIG_INPUT_MODULE) && defined(MODULE))
+#define INTERACTIVE_INPUT_BOOST
+#endif
 
 static atomic_t active_count = ATOMIC_INIT(0);
 
+/* Longest load history the predictor can be configured for */
+#define MAX_LOAD_HISTORY 8
+
+/* Frequency table entries tracked for time_in_freq */
+#define MAX_FREQ_STATS 32
+
+/*
+ * Speed changes of a policy are issued by its own realtime task, woken by
+ * the per-CPU timers with the set of CPUs that want a new speed.
+ */
+struct cpufreq_interactive_policyinfo {
+	struct task_struct *speedchange_task;
+	cpumask_t speedchange_cpumask;
+	spinlock_t speedchange_lock;
+};
+
 struct cpufreq_interactive_cpuinfo {
 	struct timer_list cpu_timer;
+	struct timer_list cpu_slack_timer;
 	int timer_idlecancel;
 	u64 time_in_idle;
 	u64 time_in_iowait;
@@ -44,23 +69,27 @@ struct cpufreq_interactive_cpuinfo {
 	u64 freq_change_time_in_idle;
 	u64 freq_change_time_in_iowait;
 	struct cpufreq_policy *policy;
+	struct cpufreq_interactive_policyinfo *ppol;
 	struct cpufreq_frequency_table *freq_table;
 	unsigned int target_freq;
 	int governor_enabled;
+
+	/* Load predictor: ring of recent short-term load samples */
+	unsigned int load_hist[MAX_LOAD_HISTORY];
+	unsigned int hist_idx;
+	unsigned int hist_cnt;
+	unsigned int predicted_load;
+	u64 pred_err_sum;
+	u64 pred_samples;
+
+	/* Time spent at each freq_table entry, kept for the policy cpu */
+	u64 freq_time[MAX_FREQ_STATS];
+	unsigned int stat_freq;
+	u64 stat_stamp;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
 
-/* Workqueues handle frequency scaling */
-static struct task_struct *up_task;
-static struct workqueue_struct *down_wq;
-static struct work_struct freq_scale_down_work;
-static cpumask_t up_cpumask;
-static spinlock_t up_cpumask_lock;
-static cpumask_t down_cpumask;
-static spinlock_t down_cpumask_lock;
-static struct mutex set_speed_lock;
-
 /* Go to max speed when CPU load at or above this value. */
 #define DEFAULT_GO_MAXSPEED_LOAD 85
 static unsigned long go_maxspeed_load;
@@ -92,6 +121,14 @@ static unsigned long min_sample_time;
 #define DEFAULT_TIMER_RATE 20000;
 static unsigned long timer_rate;
 
+/*
+ * The sampling timer is deferrable and does not wake an idle CPU.  A CPU
+ * that idles above minimum speed is woken this long (uS) after its next
+ * sample would have been due, so it can ramp down.  0 never wakes it.
+ */
+#define DEFAULT_TIMER_SLACK 80000
+static unsigned long timer_slack;
+
 /* Defines to control mid-range frequencies */
 #define DEFAULT_MID_RANGE_GO_MAXSPEED_LOAD 95
 
@@ -99,6 +136,24 @@ static unsigned long midrange_freq;
 static unsigned long midrange_go_maxspeed_load;
 static unsigned long midrange_max_boost;
 
+/*
+ * Number of short-term load samples the predictor averages over, newer
+ * samples weighing more.  1 uses only the latest sample.
+ */
+#define DEFAULT_LOAD_HISTORY 1
+static unsigned long load_history;
+
+/*
+ * Frequency to raise the CPUs to on input events, and for how long (uS).
+ * An input_boost_freq of 0 disables the boost.
+ */
+#define DEFAULT_INPUT_BOOST_DURATION 500000
+static unsigned long input_boost_freq;
+static unsigned long input_boost_duration;
+static unsigned long input_boost_until;
+
+static DEFINE_SPINLOCK(stats_lock);
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event);
 
@@ -113,25 +168,30 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 };
 
 static unsigned int cpufreq_interactive_get_target(
-	int cpu_load, int load_since_change, struct cpufreq_policy *policy)
+	int cpu_load, int predicted_load, int load_since_change,
+	struct cpufreq_policy *policy)
 {
 	unsigned int target_freq;
 	unsigned int maxspeed_load = go_maxspeed_load;
 	unsigned int mboost = max_boost;
 
-	/*
-	 * Choose greater of short-term load (since last idle timer
-	 * started or timer function re-armed itself) or long-term load
-	 * (since last frequency change).
-	 */
-	if (load_since_change > cpu_load)
-		cpu_load = load_since_change;
-
 	if (midrange_freq && policy->cur > midrange_freq) {
 		maxspeed_load = midrange_go_maxspeed_load;
 		mboost = midrange_max_boost;
 	}
 
+	/*
+	 * A busy short-term sample still ramps straight up; below that,
+	 * the load predicted from the recent history is used instead.
+	 * Choose the greater of that or long-term load (since last
+	 * frequency change).
+	 */
+	if (cpu_load < maxspeed_load)
+		cpu_load = predicted_load;
+
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
 	if (cpu_load >= maxspeed_load) {
 		if (!boost_factor)
 			return policy->max;
@@ -163,6 +223,103 @@ static inline cputime64_t get_cpu_iowait_time(
 	return iowait_time;
 }
 
+/*
+ * Record a short-term load sample, score the prediction made for it and
+ * return the load expected over the next interval: a linearly weighted
+ * average of the last load_history samples.
+ */
+static unsigned int cpufreq_interactive_predict(
+	struct cpufreq_interactive_cpuinfo *pcpu, unsigned int cpu_load)
+{
+	unsigned int len = clamp_t(unsigned int, load_history, 1,
+				   MAX_LOAD_HISTORY);
+	unsigned int i, n, idx, weight;
+	unsigned int sum = 0, wsum = 0;
+
+	if (pcpu->hist_cnt) {
+		pcpu->pred_err_sum += abs((int)cpu_load -
+					  (int)pcpu->predicted_load);
+		pcpu->pred_samples++;
+	}
+
+	pcpu->load_hist[pcpu->hist_idx] = cpu_load;
+	pcpu->hist_idx = (pcpu->hist_idx + 1) % MAX_LOAD_HISTORY;
+	if (pcpu->hist_cnt < MAX_LOAD_HISTORY)
+		pcpu->hist_cnt++;
+
+	n = min(len, pcpu->hist_cnt);
+	idx = pcpu->hist_idx;
+	for (i = 0; i < n; i++) {
+		idx = idx ? idx - 1 : MAX_LOAD_HISTORY - 1;
+		weight = n - i;
+		sum += pcpu->load_hist[idx] * weight;
+		wsum += weight;
+	}
+
+	pcpu->predicted_load = sum / wsum;
+	return pcpu->predicted_load;
+}
+
+/*
+ * Charge the time since the last call to the frequency the policy was
+ * running at, then start accounting against freq.
+ */
+static void cpufreq_interactive_account(
+	struct cpufreq_interactive_cpuinfo *pcpu, unsigned int freq)
+{
+	struct cpufreq_frequency_table *table = pcpu->freq_table;
+	unsigned long flags;
+	u64 now;
+	int i;
+
+	spin_lock_irqsave(&stats_lock, flags);
+	now = ktime_to_us(ktime_get());
+
+	for (i = 0; table && table[i].frequency != CPUFREQ_TABLE_END &&
+		     i < MAX_FREQ_STATS; i++) {
+		if (table[i].frequency == pcpu->stat_freq) {
+			pcpu->freq_time[i] += now - pcpu->stat_stamp;
+			break;
+		}
+	}
+
+	pcpu->stat_freq = freq;
+	pcpu->stat_stamp = now;
+	spin_unlock_irqrestore(&stats_lock, flags);
+}
+
+/*
+ * input_boost_until starts out at the current jiffies, and an expired
+ * value is moved up to now whenever it is looked at, so that neither
+ * the initial jiffies offset nor a wrap make an old boost look active.
+ * The cmpxchg leaves a new boost from the input handler alone.
+ */
+static inline bool cpufreq_interactive_boosted(void)
+{
+	unsigned long until = ACCESS_ONCE(input_boost_until);
+	unsigned long now = jiffies;
+
+	if (!input_boost_freq)
+		return false;
+	if (time_before(now, until))
+		return true;
+	cmpxchg(&input_boost_until, until, now);
+	return false;
+}
+
+/* Ask the policy task to re-evaluate speed on behalf of cpu */
+static void cpufreq_interactive_speedchange(
+	struct cpufreq_interactive_cpuinfo *pcpu, unsigned int cpu)
+{
+	struct cpufreq_interactive_policyinfo *ppol = pcpu->ppol;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ppol->speedchange_lock, flags);
+	cpumask_set_cpu(cpu, &ppol->speedchange_cpumask);
+	spin_unlock_irqrestore(&ppol->speedchange_lock, flags);
+	wake_up_process(ppol->speedchange_task);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -179,7 +336,6 @@ static void cpufreq_interactive_timer(unsigned long data)
 	u64 now_iowait;
 	unsigned int new_freq;
 	unsigned int index;
-	unsigned long flags;
 
 	smp_rmb();
 
@@ -245,11 +401,18 @@ static void cpufreq_interactive_timer(unsigned long data)
 
 	/*
 	 * Combine short-term load (since last idle timer started or timer
-	 * function re-armed itself) and long-term load (since last frequency
-	 * change) to determine new target frequency
+	 * function re-armed itself), the load predicted from its history
+	 * and long-term load (since last frequency change) to determine new
+	 * target frequency
 	 */
-	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
-						  pcpu->policy);
+	new_freq = cpufreq_interactive_get_target(cpu_load,
+				cpufreq_interactive_predict(pcpu, cpu_load),
+				load_since_change, pcpu->policy);
+
+	/* Do not drop below the boost while input boost is active */
+	if (cpufreq_interactive_boosted() && new_freq < input_boost_freq)
+		new_freq = min_t(unsigned int, input_boost_freq,
+				 pcpu->policy->max);
 
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
@@ -274,19 +437,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 			goto rearm;
 	}
 
-	if (new_freq < pcpu->target_freq) {
-		pcpu->target_freq = new_freq;
-		spin_lock_irqsave(&down_cpumask_lock, flags);
-		cpumask_set_cpu(data, &down_cpumask);
-		spin_unlock_irqrestore(&down_cpumask_lock, flags);
-		queue_work(down_wq, &freq_scale_down_work);
-	} else {
-		pcpu->target_freq = new_freq;
-		spin_lock_irqsave(&up_cpumask_lock, flags);
-		cpumask_set_cpu(data, &up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
-		wake_up_process(up_task);
-	}
+	pcpu->target_freq = new_freq;
+	cpufreq_interactive_speedchange(pcpu, data);
 
 rearm_if_notmax:
 	/*
@@ -357,6 +509,17 @@ static void cpufreq_interactive_idle_start(void)
 			mod_timer(&pcpu->cpu_timer,
 				  jiffies + usecs_to_jiffies(timer_rate));
 		}
+
+		/*
+		 * The sampling timer is deferrable, so make sure this CPU
+		 * does wake up to run it.  The slack timer is left armed
+		 * across idle exit rather than cancelled there; if it
+		 * fires on a busy CPU it does nothing.
+		 */
+		if (timer_slack && !timer_pending(&pcpu->cpu_slack_timer))
+			mod_timer_pinned(&pcpu->cpu_slack_timer,
+				jiffies + usecs_to_jiffies(timer_rate +
+							   timer_slack));
 #endif
 	} else {
 		/*
@@ -414,57 +577,73 @@ static void cpufreq_interactive_idle_end(void)
 
 }
 
-static int cpufreq_interactive_up_task(void *data)
+static void cpufreq_interactive_nop_timer(unsigned long data)
 {
-	unsigned int cpu;
+}
+
+static int cpufreq_interactive_speedchange_task(void *data)
+{
+	struct cpufreq_interactive_policyinfo *ppol = data;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_policy *policy;
+	unsigned int cpu, j;
+	unsigned int max_freq;
 	cpumask_t tmp_mask;
 	unsigned long flags;
-	struct cpufreq_interactive_cpuinfo *pcpu;
 
 	while (1) {
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock_irqsave(&up_cpumask_lock, flags);
+		spin_lock_irqsave(&ppol->speedchange_lock, flags);
+
+		if (cpumask_empty(&ppol->speedchange_cpumask)) {
+			spin_unlock_irqrestore(&ppol->speedchange_lock, flags);
+
+			if (kthread_should_stop())
+				break;
 
-		if (cpumask_empty(&up_cpumask)) {
-			spin_unlock_irqrestore(&up_cpumask_lock, flags);
 			schedule();
 
 			if (kthread_should_stop())
 				break;
 
-			spin_lock_irqsave(&up_cpumask_lock, flags);
+			spin_lock_irqsave(&ppol->speedchange_lock, flags);
 		}
 
 		set_current_state(TASK_RUNNING);
-		tmp_mask = up_cpumask;
-		cpumask_clear(&up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+		tmp_mask = ppol->speedchange_cpumask;
+		cpumask_clear(&ppol->speedchange_cpumask);
+		spin_unlock_irqrestore(&ppol->speedchange_lock, flags);
 
-		for_each_cpu(cpu, &tmp_mask) {
-			unsigned int j;
-			unsigned int max_freq = 0;
+		cpu = cpumask_first(&tmp_mask);
+		if (cpu >= nr_cpu_ids)
+			continue;
 
-			pcpu = &per_cpu(cpuinfo, cpu);
-			smp_rmb();
+		pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
 
-			if (!pcpu->governor_enabled)
-				continue;
+		if (!pcpu->governor_enabled)
+			continue;
 
-			mutex_lock(&set_speed_lock);
+		policy = pcpu->policy;
+		max_freq = 0;
 
-			for_each_cpu(j, pcpu->policy->cpus) {
-				struct cpufreq_interactive_cpuinfo *pjcpu =
-					&per_cpu(cpuinfo, j);
+		for_each_cpu(j, policy->cpus) {
+			struct cpufreq_interactive_cpuinfo *pjcpu =
+				&per_cpu(cpuinfo, j);
 
-				if (pjcpu->target_freq > max_freq)
-					max_freq = pjcpu->target_freq;
-			}
+			if (pjcpu->target_freq > max_freq)
+				max_freq = pjcpu->target_freq;
+		}
 
-			__cpufreq_driver_target(pcpu->policy,
-						max_freq,
+		if (max_freq != policy->cur) {
+			__cpufreq_driver_target(policy, max_freq,
 						CPUFREQ_RELATION_H);
-			mutex_unlock(&set_speed_lock);
+			cpufreq_interactive_account(
+				&per_cpu(cpuinfo, policy->cpu), policy->cur);
+		}
 
+		for_each_cpu(cpu, &tmp_mask) {
+			pcpu = &per_cpu(cpuinfo, cpu);
 			pcpu->freq_change_time_in_idle =
 				get_cpu_idle_time_us(cpu,
 						     &pcpu->freq_change_time);
@@ -473,53 +652,140 @@ static int cpufreq_interactive_up_task(void *data)
 		}
 	}
 
+	__set_current_state(TASK_RUNNING);
 	return 0;
 }
 
-static void cpufreq_interactive_freq_down(struct work_struct *work)
+#ifdef INTERACTIVE_INPUT_BOOST
+/*
+ * Raise every CPU to input_boost_freq right away instead of waiting for
+ * the load sampled after the input to catch up.  Only the event that
+ * starts a boost period kicks the policy tasks; later events just extend
+ * it.
+ */
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
 {
 	unsigned int cpu;
-	cpumask_t tmp_mask;
-	unsigned long flags;
-	struct cpufreq_interactive_cpuinfo *pcpu;
+	bool boosted;
+
+	if (!input_boost_freq)
+		return;
 
-	spin_lock_irqsave(&down_cpumask_lock, flags);
-	tmp_mask = down_cpumask;
-	cpumask_clear(&down_cpumask);
-	spin_unlock_irqrestore(&down_cpumask_lock, flags);
+	boosted = cpufreq_interactive_boosted();
+	input_boost_until = jiffies + usecs_to_jiffies(input_boost_duration);
+	if (boosted)
+		return;
 
-	for_each_cpu(cpu, &tmp_mask) {
-		unsigned int j;
-		unsigned int max_freq = 0;
+	for_each_online_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+		unsigned int freq;
 
-		pcpu = &per_cpu(cpuinfo, cpu);
 		smp_rmb();
 
 		if (!pcpu->governor_enabled)
 			continue;
 
-		mutex_lock(&set_speed_lock);
+		freq = min_t(unsigned int, input_boost_freq,
+			     pcpu->policy->max);
+		if (pcpu->target_freq >= freq)
+			continue;
 
-		for_each_cpu(j, pcpu->policy->cpus) {
-			struct cpufreq_interactive_cpuinfo *pjcpu =
-				&per_cpu(cpuinfo, j);
+		pcpu->target_freq = freq;
+		cpufreq_interactive_speedchange(pcpu, cpu);
+	}
+}
 
-			if (pjcpu->target_freq > max_freq)
-				max_freq = pjcpu->target_freq;
-		}
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
 
-		__cpufreq_driver_target(pcpu->policy, max_freq,
-					CPUFREQ_RELATION_H);
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
 
-		mutex_unlock(&set_speed_lock);
-		pcpu->freq_change_time_in_idle =
-			get_cpu_idle_time_us(cpu,
-					     &pcpu->freq_change_time);
-		pcpu->freq_change_time_in_iowait =
-			get_cpu_iowait_time(cpu, NULL);
-	}
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
+}
+
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	/* multi-touch touchscreen */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* touchpad */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	/* keypad */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+static void cpufreq_interactive_input_register(void)
+{
+	if (input_register_handler(&cpufreq_interactive_input_handler))
+		pr_warn("cpufreq_interactive: input boost unavailable\n");
 }
 
+static void cpufreq_interactive_input_unregister(void)
+{
+	input_unregister_handler(&cpufreq_interactive_input_handler);
+}
+#else
+static inline void cpufreq_interactive_input_register(void) { }
+static inline void cpufreq_interactive_input_unregister(void) { }
+#endif
+
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
@@ -735,6 +1001,165 @@ static ssize_t store_timer_rate(struct kobject *kobj,
 static struct global_attr timer_rate_attr = __ATTR(timer_rate, 0644,
 		show_timer_rate, store_timer_rate);
 
+static ssize_t show_timer_slack(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", timer_slack);
+}
+
+static ssize_t store_timer_slack(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	timer_slack = val;
+	return count;
+}
+
+static struct global_attr timer_slack_attr = __ATTR(timer_slack, 0644,
+		show_timer_slack, store_timer_slack);
+
+static ssize_t show_load_history(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", load_history);
+}
+
+static ssize_t store_load_history(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	if (val < 1 || val > MAX_LOAD_HISTORY)
+		return -EINVAL;
+	load_history = val;
+	return count;
+}
+
+static struct global_attr load_history_attr = __ATTR(load_history, 0644,
+		show_load_history, store_load_history);
+
+static ssize_t show_input_boost_freq(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_freq);
+}
+
+static ssize_t store_input_boost_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	input_boost_until = jiffies;
+	input_boost_freq = val;
+	return count;
+}
+
+static struct global_attr input_boost_freq_attr = __ATTR(input_boost_freq,
+		0644, show_input_boost_freq, store_input_boost_freq);
+
+static ssize_t show_input_boost_duration(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_duration);
+}
+
+static ssize_t store_input_boost_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	input_boost_duration = val;
+	return count;
+}
+
+static struct global_attr input_boost_duration_attr =
+	__ATTR(input_boost_duration, 0644,
+	       show_input_boost_duration, store_input_boost_duration);
+
+/* Per CPU: number of scored predictions and mean absolute error in % */
+static ssize_t show_prediction_error(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+		u64 samples = pcpu->pred_samples;
+		u64 mean = pcpu->pred_err_sum;
+
+		if (samples)
+			do_div(mean, samples);
+
+		len += sprintf(buf + len, "cpu%u %llu %llu\n", cpu,
+			       samples, mean);
+	}
+
+	return len;
+}
+
+static struct global_attr prediction_error_attr = __ATTR(prediction_error,
+		0444, show_prediction_error, NULL);
+
+/* Per policy: milliseconds spent at each frequency under this governor */
+static ssize_t show_time_in_freq(struct kobject *kobj,
+			struct attribute *attr, char *buf)
+{
+	ssize_t len = 0;
+	unsigned int cpu;
+	int i;
+
+	for_each_online_cpu(cpu) {
+		struct cpufreq_interactive_cpuinfo *pcpu =
+			&per_cpu(cpuinfo, cpu);
+		struct cpufreq_frequency_table *table;
+
+		smp_rmb();
+
+		if (!pcpu->governor_enabled || pcpu->policy->cpu != cpu)
+			continue;
+
+		cpufreq_interactive_account(pcpu, pcpu->stat_freq);
+		table = pcpu->freq_table;
+
+		for (i = 0; table && table[i].frequency != CPUFREQ_TABLE_END &&
+			     i < MAX_FREQ_STATS; i++) {
+			u64 msecs = pcpu->freq_time[i];
+
+			if (table[i].frequency == CPUFREQ_ENTRY_INVALID)
+				continue;
+
+			do_div(msecs, USEC_PER_MSEC);
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					 "cpu%u %u %llu\n", cpu,
+					 table[i].frequency, msecs);
+		}
+	}
+
+	return len;
+}
+
+static struct global_attr time_in_freq_attr = __ATTR(time_in_freq,
+		0444, show_time_in_freq, NULL);
+
 static struct attribute *interactive_attributes[] = {
 	&go_maxspeed_load_attr.attr,
 	&midrange_freq_attr.attr,
@@ -746,6 +1171,12 @@ static struct attribute *interactive_attributes[] = {
 	&sustain_load_attr.attr,
 	&min_sample_time_attr.attr,
 	&timer_rate_attr.attr,
+	&timer_slack_attr.attr,
+	&load_history_attr.attr,
+	&input_boost_freq_attr.attr,
+	&input_boost_duration_attr.attr,
+	&prediction_error_attr.attr,
+	&time_in_freq_attr.attr,
 	NULL,
 };
 
@@ -754,12 +1185,49 @@ static struct attribute_group interactive_attr_group = {
 	.name = "interactive",
 };
 
+static struct cpufreq_interactive_policyinfo *
+cpufreq_interactive_policy_alloc(struct cpufreq_policy *policy)
+{
+	struct cpufreq_interactive_policyinfo *ppol;
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+
+	ppol = kzalloc(sizeof(*ppol), GFP_KERNEL);
+	if (!ppol)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock_init(&ppol->speedchange_lock);
+
+	ppol->speedchange_task =
+		kthread_create(cpufreq_interactive_speedchange_task, ppol,
+			       "kinteractive/%u", policy->cpu);
+	if (IS_ERR(ppol->speedchange_task)) {
+		int err = PTR_ERR(ppol->speedchange_task);
+
+		kfree(ppol);
+		return ERR_PTR(err);
+	}
+
+	sched_setscheduler_nocheck(ppol->speedchange_task, SCHED_FIFO, &param);
+	get_task_struct(ppol->speedchange_task);
+
+	return ppol;
+}
+
+static void cpufreq_interactive_policy_free(
+	struct cpufreq_interactive_policyinfo *ppol)
+{
+	kthread_stop(ppol->speedchange_task);
+	put_task_struct(ppol->speedchange_task);
+	kfree(ppol);
+}
+
 static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		unsigned int event)
 {
 	int rc;
 	unsigned int j;
 	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_interactive_policyinfo *ppol;
 	struct cpufreq_frequency_table *freq_table;
 
 	switch (event) {
@@ -767,12 +1235,17 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (!cpu_online(policy->cpu))
 			return -EINVAL;
 
+		ppol = cpufreq_interactive_policy_alloc(policy);
+		if (IS_ERR(ppol))
+			return PTR_ERR(ppol);
+
 		freq_table =
 			cpufreq_frequency_get_table(policy->cpu);
 
 		for_each_cpu(j, policy->cpus) {
 			pcpu = &per_cpu(cpuinfo, j);
 			pcpu->policy = policy;
+			pcpu->ppol = ppol;
 			pcpu->target_freq = policy->cur;
 			pcpu->freq_table = freq_table;
 			pcpu->freq_change_time_in_idle =
@@ -783,6 +1256,12 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->freq_change_time_in_iowait =
 				get_cpu_iowait_time(j, NULL);
 			pcpu->time_in_iowait = pcpu->freq_change_time_in_iowait;
+			pcpu->hist_idx = 0;
+			pcpu->hist_cnt = 0;
+			if (j == policy->cpu) {
+				pcpu->stat_freq = 0;
+				cpufreq_interactive_account(pcpu, policy->cur);
+			}
 
 			pcpu->timer_idlecancel = 1;
 			pcpu->governor_enabled = 1;
@@ -804,6 +1283,9 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		if (rc)
 			return rc;
 
+		/* Forget a boost from before the governor was last stopped */
+		input_boost_until = jiffies;
+		cpufreq_interactive_input_register();
 		break;
 
 	case CPUFREQ_GOV_STOP:
@@ -812,6 +1294,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->governor_enabled = 0;
 			smp_wmb();
 			del_timer_sync(&pcpu->cpu_timer);
+			del_timer_sync(&pcpu->cpu_slack_timer);
 
 			/*
 			 * Reset idle exit time since we may cancel the timer
@@ -822,10 +1305,20 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 			pcpu->idle_exit_time = 0;
 		}
 
-		flush_work(&freq_scale_down_work);
+		/*
+		 * Input boost runs with interrupts disabled and may still
+		 * be looking at this policy; wait for it before freeing.
+		 */
+		synchronize_sched();
+		ppol = per_cpu(cpuinfo, policy->cpu).ppol;
+		for_each_cpu(j, policy->cpus)
+			per_cpu(cpuinfo, j).ppol = NULL;
+		cpufreq_interactive_policy_free(ppol);
+
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		cpufreq_interactive_input_unregister();
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
 
@@ -838,6 +1331,8 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
 		else if (policy->min > policy->cur)
 			__cpufreq_driver_target(policy,
 					policy->min, CPUFREQ_RELATION_L);
+		cpufreq_interactive_account(&per_cpu(cpuinfo, policy->cpu),
+					    policy->cur);
 		break;
 	}
 	return 0;
@@ -867,50 +1362,29 @@ static int __init cpufreq_interactive_init(void)
 {
 	unsigned int i;
 	struct cpufreq_interactive_cpuinfo *pcpu;
-	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
 	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	midrange_go_maxspeed_load = DEFAULT_MID_RANGE_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
 	timer_rate = DEFAULT_TIMER_RATE;
+	timer_slack = DEFAULT_TIMER_SLACK;
+	load_history = DEFAULT_LOAD_HISTORY;
+	input_boost_duration = DEFAULT_INPUT_BOOST_DURATION;
+	input_boost_until = jiffies;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
 		pcpu = &per_cpu(cpuinfo, i);
-		init_timer(&pcpu->cpu_timer);
+		init_timer_deferrable(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+		init_timer(&pcpu->cpu_slack_timer);
+		pcpu->cpu_slack_timer.function = cpufreq_interactive_nop_timer;
 	}
 
-	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
-				 "kinteractiveup");
-	if (IS_ERR(up_task))
-		return PTR_ERR(up_task);
-
-	sched_setscheduler_nocheck(up_task, SCHED_FIFO, &param);
-	get_task_struct(up_task);
-
-	/* No rescuer thread, bind to CPU queuing the work for possibly
-	   warm cache (probably doesn't matter much). */
-	down_wq = alloc_workqueue("knteractive_down", 0, 1);
-
-	if (!down_wq)
-		goto err_freeuptask;
-
-	INIT_WORK(&freq_scale_down_work,
-		  cpufreq_interactive_freq_down);
-
-	spin_lock_init(&up_cpumask_lock);
-	spin_lock_init(&down_cpumask_lock);
-	mutex_init(&set_speed_lock);
-
 	idle_notifier_register(&cpufreq_interactive_idle_nb);
 
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
-
-err_freeuptask:
-	put_task_struct(up_task);
-	return -ENOMEM;
 }
 
 #ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
@@ -922,9 +1396,6 @@ module_init(cpufreq_interactive_init);
 static void __exit cpufreq_interactive_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
-	kthread_stop(up_task);
-	put_task_struct(up_task);
-	destroy_workqueue(down_wq);
 }
 
 module_exit(cpufreq_interactive_exit);
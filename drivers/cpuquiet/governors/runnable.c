@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2012 NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Core count from run-queue depth: a core is added once the averaged
+ * runnable threads per online core have stayed above up_thresh for
+ * up_delay, and one is removed once the load would have fit on one core
+ * less below down_thresh for down_delay.  Thresholds are in hundredths
+ * of a thread per core.  Unlike balanced, this does not wait for the
+ * CPU frequency to reach the top of the range first.
+ */
+
+#include <linux/kernel.h>
+#include <linux/cpuquiet.h>
+#include <linux/cpumask.h>
+#include <linux/module.h>
+#include <linux/jiffies.h>
+#include <linux/slab.h>
+#include <linux/cpu.h>
+#include <linux/sched.h>
+#include <linux/workqueue.h>
+
+/* configurable parameters */
+static unsigned int  up_thresh = 110;
+static unsigned int  down_thresh = 80;
+static unsigned int  sample_rate = 20; /* msec */
+static unsigned long up_delay;
+static unsigned long down_delay;
+
+/* read-only: averaged runnable threads x100, decisions taken */
+static unsigned int  nr_run_avg;
+static unsigned int  ups;
+static unsigned int  downs;
+static unsigned int  blocked;
+
+static unsigned long trend_since;
+static int trend;
+static struct workqueue_struct *runnable_wq;
+static struct delayed_work runnable_work;
+static struct kobject *runnable_kobject;
+
+/* The online cpu, other than cpu0, with the shallowest run-queue */
+static unsigned int get_idlest_cpu_n(void)
+{
+	unsigned int cpu, idlest = nr_cpu_ids;
+	unsigned long nr, min_nr = ULONG_MAX;
+
+	for_each_online_cpu(cpu) {
+		if (cpu == 0)
+			continue;
+
+		nr = avg_cpu_nr_running(cpu);
+		if (nr < min_nr) {
+			min_nr = nr;
+			idlest = cpu;
+		}
+	}
+
+	return idlest;
+}
+
+static void runnable_work_func(struct work_struct *work)
+{
+	unsigned int nr_cpus = num_online_cpus();
+	unsigned long now = jiffies;
+	unsigned int cpu;
+	int new_trend = 0;
+
+	nr_run_avg = (avg_nr_running() * 100) >> FSHIFT;
+
+	if (nr_run_avg > nr_cpus * up_thresh)
+		new_trend = 1;
+	else if (nr_cpus > 1 && nr_run_avg < (nr_cpus - 1) * down_thresh)
+		new_trend = -1;
+
+	if (new_trend != trend) {
+		trend = new_trend;
+		trend_since = now;
+	} else if (trend > 0 && time_after_eq(now, trend_since + up_delay)) {
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		if (cpu < nr_cpu_ids) {
+			if (cpuquiet_wake_cpu(cpu))
+				blocked++;
+			else
+				ups++;
+			trend_since = now;
+		}
+	} else if (trend < 0 &&
+		   time_after_eq(now, trend_since + down_delay)) {
+		cpu = get_idlest_cpu_n();
+		if (cpu < nr_cpu_ids) {
+			if (cpuquiet_quiesence_cpu(cpu))
+				blocked++;
+			else
+				downs++;
+			trend_since = now;
+		}
+	}
+
+	queue_delayed_work(runnable_wq, &runnable_work,
+			   msecs_to_jiffies(sample_rate));
+}
+
+static void delay_callback(struct cpuquiet_attribute *attr)
+{
+	unsigned long val;
+
+	if (attr) {
+		val = (*((unsigned long *)(attr->param)));
+		(*((unsigned long *)(attr->param))) = msecs_to_jiffies(val);
+	}
+}
+
+CPQ_BASIC_ATTRIBUTE(up_thresh, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(down_thresh, 0644, uint);
+CPQ_BASIC_ATTRIBUTE(sample_rate, 0644, uint);
+CPQ_ATTRIBUTE(up_delay, 0644, ulong, delay_callback);
+CPQ_ATTRIBUTE(down_delay, 0644, ulong, delay_callback);
+CPQ_BASIC_ATTRIBUTE(nr_run_avg, 0444, uint);
+CPQ_BASIC_ATTRIBUTE(ups, 0444, uint);
+CPQ_BASIC_ATTRIBUTE(downs, 0444, uint);
+CPQ_BASIC_ATTRIBUTE(blocked, 0444, uint);
+
+static struct attribute *runnable_attributes[] = {
+	&up_thresh_attr.attr,
+	&down_thresh_attr.attr,
+	&sample_rate_attr.attr,
+	&up_delay_attr.attr,
+	&down_delay_attr.attr,
+	&nr_run_avg_attr.attr,
+	&ups_attr.attr,
+	&downs_attr.attr,
+	&blocked_attr.attr,
+	NULL,
+};
+
+static const struct sysfs_ops runnable_sysfs_ops = {
+	.show = cpuquiet_auto_sysfs_show,
+	.store = cpuquiet_auto_sysfs_store,
+};
+
+static struct kobj_type ktype_runnable = {
+	.sysfs_ops = &runnable_sysfs_ops,
+	.default_attrs = runnable_attributes,
+};
+
+static int runnable_sysfs(void)
+{
+	int err;
+
+	runnable_kobject = kzalloc(sizeof(*runnable_kobject),
+				GFP_KERNEL);
+
+	if (!runnable_kobject)
+		return -ENOMEM;
+
+	err = cpuquiet_kobject_init(runnable_kobject, &ktype_runnable,
+				"runnable");
+
+	if (err)
+		kfree(runnable_kobject);
+
+	return err;
+}
+
+static void runnable_stop(void)
+{
+	cancel_delayed_work_sync(&runnable_work);
+	destroy_workqueue(runnable_wq);
+
+	kobject_put(runnable_kobject);
+}
+
+static int runnable_start(void)
+{
+	int err;
+
+	err = runnable_sysfs();
+	if (err)
+		return err;
+
+	runnable_wq = alloc_workqueue("cpuquiet-runnable",
+			WQ_UNBOUND | WQ_RESCUER | WQ_FREEZABLE, 1);
+	if (!runnable_wq) {
+		kobject_put(runnable_kobject);
+		return -ENOMEM;
+	}
+
+	INIT_DELAYED_WORK_DEFERRABLE(&runnable_work, runnable_work_func);
+
+	up_delay = msecs_to_jiffies(70);
+	down_delay = msecs_to_jiffies(2000);
+
+	nr_run_avg = 0;
+	trend = 0;
+	trend_since = jiffies;
+	queue_delayed_work(runnable_wq, &runnable_work, 0);
+
+	return 0;
+}
+
+struct cpuquiet_governor runnable_governor = {
+	.name		= "runnable",
+	.start		= runnable_start,
+	.stop		= runnable_stop,
+	.owner		= THIS_MODULE,
+};
+
+static int __init init_runnable(void)
+{
+	return cpuquiet_register_governor(&runnable_governor);
+}
+
+static void __exit exit_runnable(void)
+{
+	cpuquiet_unregister_governor(&runnable_governor);
+}
+
+MODULE_LICENSE("GPL");
+module_init(init_runnable);
+module_exit(exit_runnable);
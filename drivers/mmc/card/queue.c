@@ -15,6 +15,8 @@
 #include <linux/freezer.h>
 #include <linux/kthread.h>
 #include <linux/scatterlist.h>
+#include <linux/percpu.h>
+#include <linux/srcu.h>
 
 #include <linux/mmc/card.h>
 #include <linux/mmc/host.h>
@@ -24,6 +26,18 @@
 
 #define MMC_QUEUE_SUSPENDED	(1 << 0)
 
+/*
+ * Number of bios a CPU stages before handing them to the block layer;
+ * 0 disables staging.
+ */
+static unsigned int swq_batch;
+module_param(swq_batch, uint, 0644);
+MODULE_PARM_DESC(swq_batch, "Bios to stage per CPU before submitting");
+
+static bool bypass_elevator;
+module_param(bypass_elevator, bool, 0444);
+MODULE_PARM_DESC(bypass_elevator, "Use the noop elevator on eMMC");
+
 /*
  * Prepare a MMC request. This just filters out odd stuff.
  */
@@ -114,6 +128,249 @@ static void mmc_request(struct request_queue *q)
 		wake_up_process(mq->thread);
 }
 
+/*
+ * Sort a staged bio list by start sector (insertion sort, lists are short)
+ * so that neighbouring bios from different submitters merge on the plug
+ * list without taking the queue lock.
+ */
+static struct bio *mmc_swq_sort(struct bio *bio)
+{
+	struct bio *sorted = NULL;
+
+	while (bio) {
+		struct bio *next = bio->bi_next;
+		struct bio **pos = &sorted;
+
+		while (*pos && (*pos)->bi_sector <= bio->bi_sector)
+			pos = &(*pos)->bi_next;
+		bio->bi_next = *pos;
+		*pos = bio;
+		bio = next;
+	}
+
+	return sorted;
+}
+
+static void mmc_swq_submit(struct mmc_queue *mq, struct bio *bio)
+{
+	bio = mmc_swq_sort(bio);
+	while (bio) {
+		struct bio *next = bio->bi_next;
+
+		bio->bi_next = NULL;
+		mq->make_request(mq->queue, bio);
+		bio = next;
+	}
+}
+
+static struct bio *mmc_swq_take(struct mmc_swq *swq, struct bio *tail)
+{
+	unsigned long flags;
+	struct bio *bio;
+
+	spin_lock_irqsave(&swq->lock, flags);
+	if (swq->bios.tail)
+		swq->bios.tail->bi_next = tail;
+	bio = bio_list_get(&swq->bios) ?: tail;
+	swq->count = 0;
+	spin_unlock_irqrestore(&swq->lock, flags);
+
+	return bio;
+}
+
+static struct bio *mmc_swq_take_all(struct mmc_swq __percpu *swqs)
+{
+	struct bio *bios = NULL;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		bios = mmc_swq_take(per_cpu_ptr(swqs, cpu), bios);
+
+	return bios;
+}
+
+/* Submit whatever every CPU has staged for this queue */
+static void mmc_swq_flush(struct mmc_queue *mq)
+{
+	struct mmc_swq __percpu *swqs;
+	struct bio *bios = NULL;
+	int idx;
+
+	idx = srcu_read_lock(&mq->swq_srcu);
+	swqs = ACCESS_ONCE(mq->swq);
+	if (swqs)
+		bios = mmc_swq_take_all(swqs);
+	srcu_read_unlock(&mq->swq_srcu, idx);
+
+	if (bios)
+		mmc_swq_submit(mq, bios);
+}
+
+static void mmc_swq_work(struct work_struct *work)
+{
+	struct mmc_queue *mq = container_of(work, struct mmc_queue, swq_work);
+	struct blk_plug plug;
+
+	blk_start_plug(&plug);
+	mmc_swq_flush(mq);
+	blk_finish_plug(&plug);
+}
+
+struct mmc_swq_plug_cb {
+	struct blk_plug_cb	cb;
+	struct mmc_queue	*mq;
+};
+
+static void mmc_swq_unplug(struct blk_plug_cb *cb)
+{
+	struct mmc_swq_plug_cb *mcb =
+		container_of(cb, struct mmc_swq_plug_cb, cb);
+	struct mmc_queue *mq = mcb->mq;
+
+	kfree(mcb);
+
+	/*
+	 * When the plug is flushed because we are about to sleep we must
+	 * not block on request allocation, so hand the batch to kblockd.
+	 */
+	if (current->state != TASK_RUNNING)
+		kblockd_schedule_work(mq->queue, &mq->swq_work);
+	else
+		mmc_swq_flush(mq);
+}
+
+/*
+ * Make sure the current plug will flush our staging queues. Returns false
+ * if there is no plug to piggyback on.
+ */
+static bool mmc_swq_check_plugged(struct mmc_queue *mq)
+{
+	struct blk_plug *plug = current->plug;
+	struct mmc_swq_plug_cb *mcb;
+
+	if (!plug)
+		return false;
+
+	list_for_each_entry(mcb, &plug->cb_list, cb.list)
+		if (mcb->cb.callback == mmc_swq_unplug && mcb->mq == mq)
+			return true;
+
+	mcb = kmalloc(sizeof(*mcb), GFP_ATOMIC);
+	if (!mcb)
+		return false;
+
+	mcb->mq = mq;
+	mcb->cb.callback = mmc_swq_unplug;
+	list_add(&mcb->cb.list, &plug->cb_list);
+	return true;
+}
+
+/*
+ * Stage plain reads and writes issued under a plug on a per-CPU list
+ * instead of going through the queue lock for each one. Everything else
+ * goes straight to the block layer.
+ */
+static int mmc_swq_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct mmc_queue *mq = q->queuedata;
+	unsigned int batch = ACCESS_ONCE(swq_batch);
+	struct mmc_swq __percpu *swqs;
+	struct mmc_swq *swq;
+	struct bio *full = NULL;
+	int idx;
+
+	if (!mq) {
+		bio_endio(bio, -EIO);
+		return 0;
+	}
+
+	if (!batch ||
+	    (bio->bi_rw & (REQ_FLUSH | REQ_FUA | REQ_DISCARD | REQ_SECURE)) ||
+	    !mmc_swq_check_plugged(mq))
+		return mq->make_request(q, bio);
+
+	/*
+	 * mmc_swq_cleanup() may have switched the queue back to the block
+	 * layer after we were called; the SRCU read section lets it wait
+	 * for us before it pushes out the last staged bios.
+	 */
+	idx = srcu_read_lock(&mq->swq_srcu);
+	swqs = ACCESS_ONCE(mq->swq);
+	if (swqs) {
+		swq = get_cpu_ptr(swqs);
+		spin_lock_irq(&swq->lock);
+		bio_list_add(&swq->bios, bio);
+		if (++swq->count >= batch) {
+			full = bio_list_get(&swq->bios);
+			swq->count = 0;
+		}
+		spin_unlock_irq(&swq->lock);
+		put_cpu_ptr(swqs);
+	}
+	srcu_read_unlock(&mq->swq_srcu, idx);
+
+	if (!swqs)
+		return mq->make_request(q, bio);
+
+	if (full)
+		mmc_swq_submit(mq, full);
+
+	return 0;
+}
+
+static int mmc_swq_init(struct mmc_queue *mq)
+{
+	int cpu;
+
+	mq->swq = alloc_percpu(struct mmc_swq);
+	if (!mq->swq)
+		return -ENOMEM;
+
+	if (init_srcu_struct(&mq->swq_srcu)) {
+		free_percpu(mq->swq);
+		mq->swq = NULL;
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct mmc_swq *swq = per_cpu_ptr(mq->swq, cpu);
+
+		spin_lock_init(&swq->lock);
+		bio_list_init(&swq->bios);
+		swq->count = 0;
+	}
+	INIT_WORK(&mq->swq_work, mmc_swq_work);
+
+	mq->make_request = mq->queue->make_request_fn;
+	mq->queue->make_request_fn = mmc_swq_make_request;
+	return 0;
+}
+
+static void mmc_swq_cleanup(struct mmc_queue *mq)
+{
+	struct mmc_swq __percpu *swqs = mq->swq;
+	struct bio *bios;
+
+	if (!swqs)
+		return;
+
+	/*
+	 * Stop staging, then wait until nobody can still be adding to or
+	 * taking from the per-CPU lists before collecting what is left.
+	 */
+	mq->queue->make_request_fn = mq->make_request;
+	mq->swq = NULL;
+	synchronize_srcu(&mq->swq_srcu);
+	cancel_work_sync(&mq->swq_work);
+
+	bios = mmc_swq_take_all(swqs);
+	if (bios)
+		mmc_swq_submit(mq, bios);
+
+	free_percpu(swqs);
+	cleanup_srcu_struct(&mq->swq_srcu);
+}
+
 struct scatterlist *mmc_alloc_sg(int sg_len, int *err)
 {
 	struct scatterlist *sg;
@@ -187,6 +444,20 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	if (mmc_can_erase(card))
 		mmc_queue_setup_discard(mq->queue, card);
 
+	ret = mmc_swq_init(mq);
+	if (ret)
+		goto cleanup_queue;
+
+	/*
+	 * Reordering buys next to nothing on eMMC, so optionally skip the
+	 * configured scheduler and keep queue lock hold times minimal.
+	 */
+	if (bypass_elevator && mmc_card_mmc(card) &&
+	    (host->caps & MMC_CAP_NONREMOVABLE) &&
+	    elevator_change(mq->queue, "noop"))
+		printk(KERN_WARNING "%s: unable to bypass the elevator\n",
+		       mmc_card_name(card));
+
 #ifdef CONFIG_MMC_BLOCK_BOUNCE
 	if (host->max_segs == 1) {
 		unsigned int bouncesz;
@@ -289,6 +560,7 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card,
 	kfree(mqrq_prev->bounce_buf);
 	mqrq_prev->bounce_buf = NULL;
 
+	mmc_swq_cleanup(mq);
 	blk_cleanup_queue(mq->queue);
 	return ret;
 }
@@ -303,6 +575,9 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	/* Make sure the queue isn't suspended, as that will deadlock */
 	mmc_queue_resume(mq);
 
+	/* Stop staging and push out anything still staged */
+	mmc_swq_cleanup(mq);
+
 	/* Then terminate our worker thread */
 	kthread_stop(mq->thread);
 
@@ -1,6 +1,10 @@
 #ifndef MMC_QUEUE_H
 #define MMC_QUEUE_H
 
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/workqueue.h>
+
 struct request;
 struct task_struct;
 
@@ -22,6 +26,17 @@ struct mmc_queue_req {
 	struct mmc_async_req	mmc_active;
 };
 
+/*
+ * Per-CPU software staging queue. Bios submitted under a plug are parked
+ * here and handed to the block layer in sector order when the plug is
+ * flushed or the queue reaches the batch size.
+ */
+struct mmc_swq {
+	spinlock_t		lock;
+	struct bio_list		bios;
+	unsigned int		count;
+};
+
 struct mmc_queue {
 	struct mmc_card		*card;
 	struct task_struct	*thread;
@@ -33,6 +48,10 @@ struct mmc_queue {
 	struct mmc_queue_req	mqrq[2];
 	struct mmc_queue_req	*mqrq_cur;
 	struct mmc_queue_req	*mqrq_prev;
+	struct mmc_swq __percpu	*swq;
+	struct srcu_struct	swq_srcu;	/* guards swq against cleanup */
+	make_request_fn		*make_request;	/* block layer's own */
+	struct work_struct	swq_work;	/* deferred staging flush */
 };
 
 extern int mmc_init_queue(struct mmc_queue *, struct mmc_card *, spinlock_t *,
@@ -424,13 +424,30 @@ static void sdhci_set_adma_desc(u8 *desc, u32 addr, int len, unsigned cmd)
 	dataddr[0] = cpu_to_le32(addr);
 }
 
-static int sdhci_adma_table_pre(struct sdhci_host *host,
-	struct mmc_data *data)
+/*
+ * Each ADMA table slot holds descriptors for all sg entries (128) and
+ * potentially one alignment transfer for each of those entries. Slot 0
+ * is used for requests mapped at issue time; slots 1 and 2 alternate
+ * between requests prepared by sdhci_pre_req(), so the table of the
+ * next request can be built while the current one is on the bus.
+ */
+#define SDHCI_ADMA_DESC_SZ	((128 * 2 + 1) * 4)
+#define SDHCI_ADMA_ALIGN_SZ	(128 * 4)
+#define SDHCI_ADMA_SLOTS	3
+
+static inline int sdhci_data_dir(struct mmc_data *data)
+{
+	return (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+}
+
+static int sdhci_adma_table_build(struct sdhci_host *host,
+	struct mmc_data *data, int sg_count, int slot,
+	dma_addr_t *adma_addr, dma_addr_t *align_addr_out)
 {
 	int direction;
 
-	u8 *desc;
-	u8 *align;
+	u8 *desc, *desc_base;
+	u8 *align, *align_base;
 	dma_addr_t addr;
 	dma_addr_t align_addr;
 	int len, offset;
@@ -445,33 +462,28 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	 * We currently guess that it is LE.
 	 */
 
-	if (data->flags & MMC_DATA_READ)
-		direction = DMA_FROM_DEVICE;
-	else
-		direction = DMA_TO_DEVICE;
+	direction = sdhci_data_dir(data);
+
+	desc_base = host->adma_desc + slot * SDHCI_ADMA_DESC_SZ;
+	align_base = host->align_buffer + slot * SDHCI_ADMA_ALIGN_SZ;
 
 	/*
 	 * The ADMA descriptor table is mapped further down as we
 	 * need to fill it with data first.
 	 */
 
-	host->align_addr = dma_map_single(mmc_dev(host->mmc),
-		host->align_buffer, 128 * 4, direction);
-	if (dma_mapping_error(mmc_dev(host->mmc), host->align_addr))
+	*align_addr_out = dma_map_single(mmc_dev(host->mmc),
+		align_base, SDHCI_ADMA_ALIGN_SZ, direction);
+	if (dma_mapping_error(mmc_dev(host->mmc), *align_addr_out))
 		goto fail;
-	BUG_ON(host->align_addr & 0x3);
+	BUG_ON(*align_addr_out & 0x3);
 
-	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
-		data->sg, data->sg_len, direction);
-	if (host->sg_count == 0)
-		goto unmap_align;
-
-	desc = host->adma_desc;
-	align = host->align_buffer;
+	desc = desc_base;
+	align = align_base;
 
-	align_addr = host->align_addr;
+	align_addr = *align_addr_out;
 
-	for_each_sg(data->sg, sg, host->sg_count, i) {
+	for_each_sg(data->sg, sg, sg_count, i) {
 		addr = sg_dma_address(sg);
 		len = sg_dma_len(sg);
 
@@ -515,14 +527,14 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 		 * If this triggers then we have a calculation bug
 		 * somewhere. :/
 		 */
-		WARN_ON((desc - host->adma_desc) > (128 * 2 + 1) * 4);
+		WARN_ON((desc - desc_base) > SDHCI_ADMA_DESC_SZ);
 	}
 
 	if (host->quirks & SDHCI_QUIRK_NO_ENDATTR_IN_NOPDESC) {
 		/*
 		* Mark the last descriptor as the terminating descriptor
 		*/
-		if (desc != host->adma_desc) {
+		if (desc != desc_base) {
 			desc -= 8;
 			desc[0] |= 0x2; /* end */
 		}
@@ -540,27 +552,55 @@ static int sdhci_adma_table_pre(struct sdhci_host *host,
 	 */
 	if (data->flags & MMC_DATA_WRITE) {
 		dma_sync_single_for_device(mmc_dev(host->mmc),
-			host->align_addr, 128 * 4, direction);
+			*align_addr_out, SDHCI_ADMA_ALIGN_SZ, direction);
 	}
 
-	host->adma_addr = dma_map_single(mmc_dev(host->mmc),
-		host->adma_desc, (128 * 2 + 1) * 4, DMA_TO_DEVICE);
-	if (dma_mapping_error(mmc_dev(host->mmc), host->adma_addr))
-		goto unmap_entries;
-	BUG_ON(host->adma_addr & 0x3);
+	*adma_addr = dma_map_single(mmc_dev(host->mmc),
+		desc_base, SDHCI_ADMA_DESC_SZ, DMA_TO_DEVICE);
+	if (dma_mapping_error(mmc_dev(host->mmc), *adma_addr))
+		goto unmap_align;
+	BUG_ON(*adma_addr & 0x3);
 
 	return 0;
 
-unmap_entries:
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
 unmap_align:
-	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
-		128 * 4, direction);
+	dma_unmap_single(mmc_dev(host->mmc), *align_addr_out,
+		SDHCI_ADMA_ALIGN_SZ, direction);
 fail:
 	return -EINVAL;
 }
 
+static void sdhci_adma_table_unmap(struct sdhci_host *host,
+	struct mmc_data *data, dma_addr_t adma_addr, dma_addr_t align_addr)
+{
+	dma_unmap_single(mmc_dev(host->mmc), adma_addr,
+		SDHCI_ADMA_DESC_SZ, DMA_TO_DEVICE);
+
+	dma_unmap_single(mmc_dev(host->mmc), align_addr,
+		SDHCI_ADMA_ALIGN_SZ, sdhci_data_dir(data));
+}
+
+static int sdhci_adma_table_pre(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	int direction = sdhci_data_dir(data);
+
+	host->sg_count = dma_map_sg(mmc_dev(host->mmc),
+		data->sg, data->sg_len, direction);
+	if (host->sg_count == 0)
+		return -EINVAL;
+
+	host->adma_slot = 0;
+	if (sdhci_adma_table_build(host, data, host->sg_count, 0,
+			&host->adma_addr, &host->align_addr)) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 static void sdhci_adma_table_post(struct sdhci_host *host,
 	struct mmc_data *data)
 {
@@ -572,22 +612,16 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 	char *buffer;
 	unsigned long flags;
 
-	if (data->flags & MMC_DATA_READ)
-		direction = DMA_FROM_DEVICE;
-	else
-		direction = DMA_TO_DEVICE;
-
-	dma_unmap_single(mmc_dev(host->mmc), host->adma_addr,
-		(128 * 2 + 1) * 4, DMA_TO_DEVICE);
+	direction = sdhci_data_dir(data);
 
-	dma_unmap_single(mmc_dev(host->mmc), host->align_addr,
-		128 * 4, direction);
+	sdhci_adma_table_unmap(host, data, host->adma_addr, host->align_addr);
 
 	if (data->flags & MMC_DATA_READ) {
 		dma_sync_sg_for_cpu(mmc_dev(host->mmc), data->sg,
 			data->sg_len, direction);
 
-		align = host->align_buffer;
+		align = host->align_buffer +
+			host->adma_slot * SDHCI_ADMA_ALIGN_SZ;
 
 		for_each_sg(data->sg, sg, host->sg_count, i) {
 			if (sg_dma_address(sg) & 0x3) {
@@ -603,8 +637,10 @@ static void sdhci_adma_table_post(struct sdhci_host *host,
 		}
 	}
 
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-		data->sg_len, direction);
+	/* Pre-mapped requests are unmapped by sdhci_post_req() */
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg,
+			data->sg_len, direction);
 }
 
 static u8 sdhci_calc_timeout(struct sdhci_host *host, struct mmc_command *cmd)
@@ -674,6 +710,100 @@ static void sdhci_set_transfer_irqs(struct sdhci_host *host)
 		sdhci_clear_set_irqs(host, dma_irqs, pio_irqs);
 }
 
+/*
+ * Check whether the scatterlist can be handed to the DMA engine at all,
+ * given the controller quirks; otherwise the transfer falls back to PIO.
+ */
+static bool sdhci_data_dma_ok(struct sdhci_host *host, struct mmc_data *data)
+{
+	struct scatterlist *sg;
+	int broken, i;
+
+	/*
+	 * FIXME: This doesn't account for merging when mapping the
+	 * scatterlist.
+	 */
+	broken = 0;
+	if (host->flags & SDHCI_USE_ADMA) {
+		if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
+			broken = 1;
+	} else {
+		if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
+			broken = 1;
+	}
+
+	if (unlikely(broken)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->length & 0x3) {
+				DBG("Reverting to PIO because of "
+					"transfer size (%d)\n",
+					sg->length);
+				return false;
+			}
+		}
+	}
+
+	/*
+	 * The assumption here being that alignment is the same after
+	 * translation to device address space.
+	 */
+	broken = 0;
+	if (host->flags & SDHCI_USE_ADMA) {
+		/*
+		 * As we use 3 byte chunks to work around
+		 * alignment problems, we need to check this
+		 * quirk.
+		 */
+		if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
+			broken = 1;
+	} else {
+		if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
+			broken = 1;
+	}
+
+	if (unlikely(broken)) {
+		for_each_sg(data->sg, sg, data->sg_len, i) {
+			if (sg->offset & 0x3) {
+				DBG("Reverting to PIO because of "
+					"bad alignment\n");
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Pick up the mapping done by sdhci_pre_req() if this is the request
+ * it prepared. Returns false if the data still has to be mapped.
+ */
+static bool sdhci_get_next_data(struct sdhci_host *host,
+	struct mmc_data *data)
+{
+	struct sdhci_host_next *next = &host->next_data;
+
+	if (data->host_cookie && (data->host_cookie != next->cookie ||
+				  !next->pending)) {
+		printk(KERN_WARNING "%s: invalid cookie: data->host_cookie %d"
+		       " host->next_data.cookie %d\n",
+		       mmc_hostname(host->mmc), data->host_cookie,
+		       next->cookie);
+		data->host_cookie = 0;
+	}
+
+	if (!data->host_cookie)
+		return false;
+
+	host->sg_count = next->sg_count;
+	host->adma_slot = next->slot;
+	host->adma_addr = next->adma_addr;
+	host->align_addr = next->align_addr;
+	next->pending = false;
+
+	return true;
+}
+
 static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 {
 	u8 count;
@@ -703,71 +833,21 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 	if (host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA))
 		host->flags |= SDHCI_REQ_USE_DMA;
 
-	/*
-	 * FIXME: This doesn't account for merging when mapping the
-	 * scatterlist.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
+	if ((host->flags & SDHCI_REQ_USE_DMA) &&
+	    !sdhci_data_dma_ok(host, data))
+		host->flags &= ~SDHCI_REQ_USE_DMA;
 
-		broken = 0;
+	if ((host->flags & SDHCI_REQ_USE_DMA) &&
+	    sdhci_get_next_data(host, data)) {
 		if (host->flags & SDHCI_USE_ADMA) {
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
+			sdhci_writel(host, host->adma_addr,
+				SDHCI_ADMA_ADDRESS);
 		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_SIZE)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->length & 0x3) {
-					DBG("Reverting to PIO because of "
-						"transfer size (%d)\n",
-						sg->length);
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
-		}
-	}
-
-	/*
-	 * The assumption here being that alignment is the same after
-	 * translation to device address space.
-	 */
-	if (host->flags & SDHCI_REQ_USE_DMA) {
-		int broken, i;
-		struct scatterlist *sg;
-
-		broken = 0;
-		if (host->flags & SDHCI_USE_ADMA) {
-			/*
-			 * As we use 3 byte chunks to work around
-			 * alignment problems, we need to check this
-			 * quirk.
-			 */
-			if (host->quirks & SDHCI_QUIRK_32BIT_ADMA_SIZE)
-				broken = 1;
-		} else {
-			if (host->quirks & SDHCI_QUIRK_32BIT_DMA_ADDR)
-				broken = 1;
-		}
-
-		if (unlikely(broken)) {
-			for_each_sg(data->sg, sg, data->sg_len, i) {
-				if (sg->offset & 0x3) {
-					DBG("Reverting to PIO because of "
-						"bad alignment\n");
-					host->flags &= ~SDHCI_REQ_USE_DMA;
-					break;
-				}
-			}
+			WARN_ON(host->sg_count != 1);
+			sdhci_writel(host, sg_dma_address(data->sg),
+				SDHCI_DMA_ADDRESS);
 		}
-	}
-
-	if (host->flags & SDHCI_REQ_USE_DMA) {
+	} else if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA) {
 			ret = sdhci_adma_table_pre(host, data);
 			if (ret) {
@@ -786,9 +866,7 @@ static void sdhci_prepare_data(struct sdhci_host *host, struct mmc_command *cmd)
 
 			sg_cnt = dma_map_sg(mmc_dev(host->mmc),
 					data->sg, data->sg_len,
-					(data->flags & MMC_DATA_READ) ?
-						DMA_FROM_DEVICE :
-						DMA_TO_DEVICE);
+					sdhci_data_dir(data));
 			if (sg_cnt == 0) {
 				/*
 				 * This only happens when someone fed
@@ -886,10 +964,9 @@ static void sdhci_finish_data(struct sdhci_host *host)
 	if (host->flags & SDHCI_REQ_USE_DMA) {
 		if (host->flags & SDHCI_USE_ADMA)
 			sdhci_adma_table_post(host, data);
-		else {
+		else if (!data->host_cookie) {
 			dma_unmap_sg(mmc_dev(host->mmc), data->sg,
-				data->sg_len, (data->flags & MMC_DATA_READ) ?
-					DMA_FROM_DEVICE : DMA_TO_DEVICE);
+				data->sg_len, sdhci_data_dir(data));
 		}
 	}
 
@@ -1281,6 +1358,80 @@ static void sdhci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+/*
+ * Map the scatterlist, and for ADMA build the descriptor table, of the
+ * next request while the current one is still being transferred. The
+ * cache maintenance done by dma_map_sg() then no longer sits between
+ * the completion of one request and the issue of the next.
+ */
+static void sdhci_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			  bool is_first_req)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	struct sdhci_host_next *next = &host->next_data;
+	int direction, sg_count, slot;
+
+	if (!data)
+		return;
+
+	if (data->host_cookie) {
+		data->host_cookie = 0;
+		return;
+	}
+
+	if (!(host->flags & (SDHCI_USE_SDMA | SDHCI_USE_ADMA)) ||
+	    !sdhci_data_dma_ok(host, data))
+		return;
+
+	direction = sdhci_data_dir(data);
+
+	sg_count = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+			      direction);
+	if (sg_count == 0)
+		return;
+
+	/* Never reuse the table slot of the request on the bus */
+	slot = 0;
+	if (host->flags & SDHCI_USE_ADMA) {
+		slot = host->adma_slot == 1 ? 2 : 1;
+		if (sdhci_adma_table_build(host, data, sg_count, slot,
+				&next->adma_addr, &next->align_addr)) {
+			dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
+				     direction);
+			return;
+		}
+	}
+
+	next->sg_count = sg_count;
+	next->slot = slot;
+	next->pending = true;
+	data->host_cookie = ++next->cookie < 0 ? 1 : next->cookie;
+}
+
+static void sdhci_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			   int err)
+{
+	struct sdhci_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	struct sdhci_host_next *next = &host->next_data;
+
+	if (!data || !data->host_cookie)
+		return;
+
+	/* Prepared but never issued, the ADMA table is still mapped */
+	if (next->pending && data->host_cookie == next->cookie) {
+		if (host->flags & SDHCI_USE_ADMA)
+			sdhci_adma_table_unmap(host, data, next->adma_addr,
+					       next->align_addr);
+		next->pending = false;
+	}
+
+	dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		     sdhci_data_dir(data));
+	data->host_cookie = 0;
+}
+
 static void sdhci_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
 	struct sdhci_host *host;
@@ -1906,6 +2057,8 @@ int sdhci_disable(struct mmc_host *mmc, int lazy)
 }
 
 static const struct mmc_host_ops sdhci_ops = {
+	.pre_req	= sdhci_pre_req,
+	.post_req	= sdhci_post_req,
 	.request	= sdhci_request,
 	.set_ios	= sdhci_set_ios,
 	.get_ro		= sdhci_get_ro,
@@ -2122,7 +2275,7 @@ static void sdhci_cmd_irq(struct sdhci_host *host, u32 intmask)
 static void sdhci_show_adma_error(struct sdhci_host *host)
 {
 	const char *name = mmc_hostname(host->mmc);
-	u8 *desc = host->adma_desc;
+	u8 *desc = host->adma_desc + host->adma_slot * SDHCI_ADMA_DESC_SZ;
 	__le32 *dma;
 	__le16 *len;
 	u8 attr;
@@ -2552,10 +2705,12 @@ int sdhci_add_host(struct sdhci_host *host)
 		/*
 		 * We need to allocate descriptors for all sg entries
 		 * (128) and potentially one alignment transfer for
-		 * each of those entries.
+		 * each of those entries, for every table slot.
 		 */
-		host->adma_desc = kmalloc((128 * 2 + 1) * 4, GFP_KERNEL);
-		host->align_buffer = kmalloc(128 * 4, GFP_KERNEL);
+		host->adma_desc = kmalloc(SDHCI_ADMA_SLOTS *
+			SDHCI_ADMA_DESC_SZ, GFP_KERNEL);
+		host->align_buffer = kmalloc(SDHCI_ADMA_SLOTS *
+			SDHCI_ADMA_ALIGN_SZ, GFP_KERNEL);
 		if (!host->adma_desc || !host->align_buffer) {
 			kfree(host->adma_desc);
 			kfree(host->align_buffer);
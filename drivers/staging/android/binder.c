@@ -19,7 +19,9 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/math64.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -36,9 +38,116 @@
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Lock usage statistics, shown in debugfs. All instances of a lock share
+ * one struct binder_lock_stats.
+ */
+struct binder_lock_stats {
+	spinlock_t lock;
+	u64 acquired;		/* no. of times the lock was taken */
+	u64 contended;		/* --do-- after waiting for another holder */
+	u64 wait_ns;		/* total time spent waiting */
+	u64 max_wait_ns;
+	u64 hold_ns;		/* total time the lock was held */
+	u64 max_hold_ns;
+};
+
+struct binder_mutex {
+	struct mutex mutex;
+	struct binder_lock_stats *stats;
+	/* set by the current holder */
+	u64 locked_at;
+	u64 wait_ns;
+	int contended;
+};
+
+static void binder_mutex_init(struct binder_mutex *lock,
+			      struct binder_lock_stats *stats)
+{
+	mutex_init(&lock->mutex);
+	lock->stats = stats;
+}
+
+static void binder_mutex_lock(struct binder_mutex *lock)
+{
+	u64 start;
+
+	if (mutex_trylock(&lock->mutex)) {
+		lock->locked_at = local_clock();
+		lock->wait_ns = 0;
+		lock->contended = 0;
+		return;
+	}
+
+	start = local_clock();
+	mutex_lock(&lock->mutex);
+	lock->locked_at = local_clock();
+	lock->wait_ns = lock->locked_at > start ? lock->locked_at - start : 0;
+	lock->contended = 1;
+}
+
+static int binder_mutex_trylock(struct binder_mutex *lock)
+{
+	if (!mutex_trylock(&lock->mutex))
+		return 0;
+
+	lock->locked_at = local_clock();
+	lock->wait_ns = 0;
+	lock->contended = 0;
+	return 1;
+}
+
+static void binder_mutex_unlock(struct binder_mutex *lock)
+{
+	struct binder_lock_stats *stats = lock->stats;
+	u64 now = local_clock();
+	u64 hold_ns = now > lock->locked_at ? now - lock->locked_at : 0;
+	u64 wait_ns = lock->wait_ns;
+	int contended = lock->contended;
+
+	mutex_unlock(&lock->mutex);
+
+	spin_lock(&stats->lock);
+	stats->acquired++;
+	stats->contended += contended;
+	stats->wait_ns += wait_ns;
+	stats->max_wait_ns = max(stats->max_wait_ns, wait_ns);
+	stats->hold_ns += hold_ns;
+	stats->max_hold_ns = max(stats->max_hold_ns, hold_ns);
+	spin_unlock(&stats->lock);
+}
+
+static struct binder_lock_stats binder_main_lock_stats = {
+	.lock = __SPIN_LOCK_UNLOCKED(binder_main_lock_stats.lock),
+};
+static struct binder_lock_stats binder_alloc_lock_stats = {
+	.lock = __SPIN_LOCK_UNLOCKED(binder_alloc_lock_stats.lock),
+};
+
+/*
+ * The main lock protects the object graph shared between processes:
+ * threads, nodes, refs, transaction stacks and todo lists. Each proc's
+ * buffer allocator has its own lock, which nests inside the main one.
+ * Buffers are allocated, filled and freed with only the latter held, so
+ * page allocation, mapping and user copies do not serialize unrelated
+ * processes.
+ */
+static struct binder_mutex binder_main_lock = {
+	.mutex = __MUTEX_INITIALIZER(binder_main_lock.mutex),
+	.stats = &binder_main_lock_stats,
+};
 static DEFINE_MUTEX(binder_deferred_lock);
 
+static inline void binder_lock(void)
+{
+	binder_mutex_lock(&binder_main_lock);
+}
+
+static inline void binder_unlock(void)
+{
+	binder_mutex_unlock(&binder_main_lock);
+}
+
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
@@ -105,6 +214,9 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+static int binder_inherit_rt = 1;
+module_param_named(inherit_rt, binder_inherit_rt, bool, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -164,6 +276,48 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+/*
+ * Latency histogram with log2 buckets: bucket 0 counts latencies below
+ * 1us, bucket n those in [2^(n-1), 2^n) us, the last one everything
+ * from about half a second up.
+ */
+#define BINDER_LATENCY_BUCKETS	21
+
+struct binder_latency {
+	u32 count;
+	u32 max_us;
+	u64 total_us;
+	u32 buckets[BINDER_LATENCY_BUCKETS];
+};
+
+/* per node, allocated when the first transaction is delivered to it */
+struct binder_node_stats {
+	u32 calls;
+	u32 oneway_calls;
+	struct binder_latency queue;	/* send to pickup by a thread */
+	struct binder_latency service;	/* pickup to reply */
+};
+
+static inline u64 binder_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void binder_latency_add(struct binder_latency *lat,
+			       u64 start_ns, u64 end_ns)
+{
+	u32 us;
+
+	if (!start_ns || end_ns < start_ns)
+		return;
+
+	us = min_t(u64, div_u64(end_ns - start_ns, NSEC_PER_USEC), UINT_MAX);
+	lat->count++;
+	lat->total_us += us;
+	lat->max_us = max(lat->max_us, us);
+	lat->buckets[min(fls(us), BINDER_LATENCY_BUCKETS - 1)]++;
+}
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -210,6 +364,20 @@ struct binder_work {
 	} type;
 };
 
+/*
+ * A scheduling priority as carried by transactions: either an rt policy
+ * with its kernel prio (0-99), or SCHED_NORMAL with the prio matching a
+ * nice value (100-139). Lower is stronger in both cases.
+ */
+struct binder_priority {
+	unsigned int sched_policy;
+	int prio;
+};
+
+/* the scheduler keeps its own copies of these private */
+#define BINDER_NICE_TO_PRIO(nice)	(MAX_RT_PRIO + (nice) + 20)
+#define BINDER_PRIO_TO_NICE(prio)	((prio) - MAX_RT_PRIO - 20)
+
 struct binder_node {
 	int debug_id;
 	struct binder_work work;
@@ -230,8 +398,10 @@ struct binder_node {
 	unsigned pending_weak_ref:1;
 	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
-	unsigned min_priority:8;
+	unsigned sched_policy:2;
+	int min_priority;		/* kernel prio, see binder_priority */
 	struct list_head async_todo;
+	struct binder_node_stats *stats;
 };
 
 struct binder_ref_death {
@@ -279,6 +449,21 @@ enum binder_deferred_state {
 	BINDER_DEFERRED_RELEASE      = 0x04,
 };
 
+/*
+ * Pages of freed buffers are kept mapped on a global LRU instead of
+ * being unmapped right away, so that the next allocation can use them
+ * without allocating, mapping or taking mmap_sem. They are returned to
+ * the system by binder_shrink() under memory pressure.
+ */
+struct binder_lru_page {
+	struct list_head lru;		/* in binder_lru while unused */
+	struct binder_proc *proc;
+};
+
+static DEFINE_SPINLOCK(binder_lru_lock);
+static LIST_HEAD(binder_lru);
+static int binder_lru_count;
+
 struct binder_proc {
 	struct hlist_node proc_node;
 	struct rb_root threads;
@@ -294,23 +479,37 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/* protected by alloc_lock */
+	struct binder_mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	struct binder_lru_page *lru_pages;
+	struct mm_struct *vma_vm_mm;
 	size_t buffer_size;
 	uint32_t buffer_free;
+	unsigned pages_reused;		/* pages taken back off the LRU */
+	unsigned pages_reclaimed;	/* --do-- taken back by the shrinker */
+
+	/* keeps a released proc around while the main lock is dropped */
+	int tmp_ref;
+	int is_dead;
+
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency call_latency;	/* call to reply, as client */
+	struct binder_latency queue_latency;	/* call to pickup */
+	struct binder_latency service_latency;	/* pickup to reply */
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
 	int requested_threads_started;
 	int ready_threads;
-	long default_priority;
+	struct binder_priority default_priority;
 	struct dentry *debugfs_entry;
 };
 
@@ -352,9 +551,11 @@ struct binder_transaction {
 	struct binder_buffer *buffer;
 	unsigned int	code;
 	unsigned int	flags;
-	long	priority;
-	long	saved_priority;
+	struct binder_priority	priority;
+	struct binder_priority	saved_priority;
 	uid_t	sender_euid;
+	u64	start_ns;	/* when the call was sent */
+	u64	wakeup_ns;	/* when a thread picked it up */
 };
 
 static void
@@ -515,6 +716,100 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static inline int binder_is_rt_policy(unsigned int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static struct binder_priority binder_task_priority(struct task_struct *task)
+{
+	struct binder_priority p;
+
+	if (binder_is_rt_policy(task->policy)) {
+		p.sched_policy = task->policy;
+		p.prio = task->normal_prio;
+	} else {
+		p.sched_policy = SCHED_NORMAL;
+		p.prio = task->static_prio;
+	}
+	return p;
+}
+
+/* Converts the priority given in flat_binder_object flags */
+static int binder_flags_to_prio(unsigned int policy, unsigned long flags)
+{
+	int priority = (s8)(flags & FLAT_BINDER_FLAG_PRIORITY_MASK);
+
+	if (binder_is_rt_policy(policy))
+		return MAX_RT_PRIO - 1 -
+			clamp(priority, 1, MAX_USER_RT_PRIO - 1);
+	return BINDER_NICE_TO_PRIO(clamp(priority, -20, 19));
+}
+
+/*
+ * Node owners may only ask for an rt minimum priority they could set
+ * themselves: it is applied to their threads without further checks.
+ */
+static bool binder_can_use_rt_prio(int prio)
+{
+	unsigned long rt_prio = MAX_RT_PRIO - 1 - prio;
+
+	return capable(CAP_SYS_NICE) ||
+	       rt_prio <= task_rlimit(current, RLIMIT_RTPRIO);
+}
+
+/*
+ * Moves current to priority p. Rt priorities come either from a caller
+ * that was running at them, or from a node minimum that the node owner
+ * was allowed to use when it created the node (binder_can_use_rt_prio),
+ * so no permission check is done for them here; nice values are capped
+ * by binder_set_nice() as before.
+ */
+static void binder_set_priority(struct binder_priority p)
+{
+	struct sched_param param;
+
+	if (binder_is_rt_policy(p.sched_policy)) {
+		if (current->policy == p.sched_policy &&
+		    current->normal_prio == p.prio)
+			return;
+		param.sched_priority = MAX_RT_PRIO - 1 - p.prio;
+		sched_setscheduler_nocheck(current,
+			p.sched_policy | SCHED_RESET_ON_FORK, &param);
+		return;
+	}
+
+	if (binder_is_rt_policy(current->policy)) {
+		param.sched_priority = 0;
+		sched_setscheduler_nocheck(current, SCHED_NORMAL, &param);
+	}
+	if (current->static_prio != p.prio)
+		binder_set_nice(BINDER_PRIO_TO_NICE(p.prio));
+}
+
+/*
+ * Called by the thread picking up t for node. Synchronous calls run at
+ * the caller's priority, one way calls keep the thread's own; either
+ * is raised to the node's minimum if that is stronger.
+ */
+static void binder_transaction_priority(struct binder_transaction *t,
+					struct binder_node *node)
+{
+	struct binder_priority desired;
+
+	t->saved_priority = binder_task_priority(current);
+	if (t->flags & TF_ONE_WAY)
+		desired = t->saved_priority;
+	else
+		desired = t->priority;
+
+	if (node->min_priority < desired.prio) {
+		desired.sched_policy = node->sched_policy;
+		desired.prio = node->min_priority;
+	}
+	binder_set_priority(desired);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -607,74 +902,138 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
-static int binder_update_page_range(struct binder_proc *proc, int allocate,
-				    void *start, void *end,
-				    struct vm_area_struct *vma)
+static inline int binder_page_index(struct binder_proc *proc,
+				    void *page_addr)
+{
+	return (page_addr - proc->buffer) / PAGE_SIZE;
+}
+
+/* Puts the mapped pages in start-end on the LRU */
+static void binder_free_page_range(struct binder_proc *proc,
+				   void *start, void *end)
 {
 	void *page_addr;
+
+	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: free pages %p-%p\n", proc->pid, start, end);
+
+	spin_lock(&binder_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		int i = binder_page_index(proc, page_addr);
+
+		if (!proc->pages[i])
+			continue;
+		BUG_ON(!list_empty(&proc->lru_pages[i].lru));
+		list_add_tail(&proc->lru_pages[i].lru, &binder_lru);
+		binder_lru_count++;
+	}
+	spin_unlock(&binder_lru_lock);
+}
+
+/*
+ * Makes sure start-end is backed by pages mapped in the kernel and in
+ * userspace. Pages still on the LRU are just taken off it; the missing
+ * ones are allocated and mapped into the kernel one run at a time.
+ * mmap_sem is only needed if there are missing pages.
+ */
+static int binder_alloc_page_range(struct binder_proc *proc,
+				   void *start, void *end,
+				   struct vm_area_struct *vma)
+{
+	void *page_addr, *run_start;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
-	struct mm_struct *mm;
+	struct page **page_array_ptr;
+	struct mm_struct *mm = NULL;
+	int i, ret, missing = 0;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-		     "binder: %d: %s pages %p-%p\n", proc->pid,
-		     allocate ? "allocate" : "free", start, end);
+		     "binder: %d: allocate pages %p-%p\n", proc->pid,
+		     start, end);
 
 	if (end <= start)
 		return 0;
 
-	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
-
-	if (mm) {
-		down_write(&mm->mmap_sem);
-		vma = proc->vma;
+	spin_lock(&binder_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		i = binder_page_index(proc, page_addr);
+		if (!proc->pages[i]) {
+			missing++;
+			continue;
+		}
+		BUG_ON(list_empty(&proc->lru_pages[i].lru));
+		list_del_init(&proc->lru_pages[i].lru);
+		binder_lru_count--;
+		proc->pages_reused++;
 	}
+	spin_unlock(&binder_lru_lock);
 
-	if (allocate == 0)
-		goto free_range;
+	if (!missing)
+		return 0;
+
+	if (vma == NULL) {
+		mm = get_task_mm(proc->tsk);
+		if (mm) {
+			down_write(&mm->mmap_sem);
+			vma = proc->vma;
+		}
+	}
 
 	if (vma == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
 		       "map pages in userspace, no vma\n", proc->pid);
-		goto err_no_vma;
+		goto err;
 	}
 
-	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+	page_addr = start;
+	while (page_addr < end) {
+		if (proc->pages[binder_page_index(proc, page_addr)]) {
+			page_addr += PAGE_SIZE;
+			continue;
+		}
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
+		run_start = page_addr;
+		for (; page_addr < end; page_addr += PAGE_SIZE) {
+			struct page **page;
+
+			page = &proc->pages[binder_page_index(proc, page_addr)];
+			if (*page)
+				break;
+			*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (*page == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n",
+				       proc->pid, page_addr);
+				goto err_free_run;
+			}
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+
+		tmp_area.addr = run_start;
+		tmp_area.size = page_addr - run_start + PAGE_SIZE;
+		page_array_ptr = &proc->pages[binder_page_index(proc,
+								run_start)];
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
+			       "to map pages at %p in kernel\n",
+			       proc->pid, run_start);
+			goto err_unmap_run;
 		}
-		user_page_addr =
-			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %lx in userspace\n",
-			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+
+		for (; run_start < page_addr; run_start += PAGE_SIZE) {
+			i = binder_page_index(proc, run_start);
+			user_page_addr =
+				(uintptr_t)run_start + proc->user_buffer_offset;
+			ret = vm_insert_page(vma, user_page_addr,
+					     proc->pages[i]);
+			if (ret) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", proc->pid,
+				       user_page_addr);
+				goto err_unmap_run;
+			}
 		}
-		/* vm_insert_page does not seem to increment the refcount */
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -682,22 +1041,22 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	}
 	return 0;
 
-free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
-err_alloc_page_failed:
-		;
-	}
-err_no_vma:
+err_unmap_run:
+	unmap_kernel_range((unsigned long)run_start, page_addr - run_start);
+err_free_run:
+	/* Pages of the failed run are not mapped in userspace */
+	for (; run_start < page_addr; run_start += PAGE_SIZE) {
+		struct page **page;
+
+		page = &proc->pages[binder_page_index(proc, run_start)];
+		if (*page) {
+			__free_page(*page);
+			*page = NULL;
+		}
+	}
+err:
+	/* Everything mapped so far goes back to the LRU */
+	binder_free_page_range(proc, start, end);
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -705,9 +1064,87 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmaps page i of proc from userspace and the kernel and frees it.
+ * Called with the allocator lock held. Only trylocks mmap_sem, since
+ * we may be called from reclaim with it held.
+ */
+static int binder_reclaim_page(struct binder_proc *proc, int i)
+{
+	void *page_addr = proc->buffer + i * PAGE_SIZE;
+	struct mm_struct *mm = proc->vma_vm_mm;
+
+	/* Without users the address space is being torn down anyway */
+	if (!atomic_inc_not_zero(&mm->mm_users))
+		mm = NULL;
+
+	if (mm) {
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return 0;
+		}
+		if (proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(proc->pages[i]);
+	proc->pages[i] = NULL;
+	proc->pages_reclaimed++;
+
+	return 1;
+}
+
+static int binder_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	int nr_to_scan = sc->nr_to_scan;
+	struct binder_lru_page *lru_page;
+	struct binder_proc *proc;
+	int freed;
+
+	spin_lock(&binder_lru_lock);
+	while (nr_to_scan-- > 0 && !list_empty(&binder_lru)) {
+		lru_page = list_first_entry(&binder_lru,
+					    struct binder_lru_page, lru);
+		proc = lru_page->proc;
+
+		/* The allocator lock keeps proc from going away */
+		if (!binder_mutex_trylock(&proc->alloc_lock)) {
+			list_move_tail(&lru_page->lru, &binder_lru);
+			continue;
+		}
+		list_del_init(&lru_page->lru);
+		binder_lru_count--;
+		spin_unlock(&binder_lru_lock);
+
+		freed = binder_reclaim_page(proc, lru_page - proc->lru_pages);
+
+		spin_lock(&binder_lru_lock);
+		if (!freed) {
+			list_add_tail(&lru_page->lru, &binder_lru);
+			binder_lru_count++;
+		}
+		spin_unlock(&binder_lru_lock);
+		binder_mutex_unlock(&proc->alloc_lock);
+		spin_lock(&binder_lru_lock);
+	}
+	spin_unlock(&binder_lru_lock);
+
+	return binder_lru_count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -781,7 +1218,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
 		end_page_addr = has_page_addr;
-	if (binder_update_page_range(proc, 1,
+	if (binder_alloc_page_range(proc,
 	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
 		return NULL;
 
@@ -811,6 +1248,28 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/*
+ * May sleep to allocate and map pages. The buffer can not be freed by
+ * its owner until allow_user_free is set when it gets delivered.
+ */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	binder_mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async);
+	if (buffer) {
+		buffer->allow_user_free = 0;
+		buffer->transaction = NULL;
+		buffer->target_node = NULL;
+	}
+	binder_mutex_unlock(&proc->alloc_lock);
+
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -861,15 +1320,15 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 			     "not share page%s%s with with %p or %p\n",
 			     proc->pid, buffer, free_page_start ? "" : " end",
 			     free_page_end ? "" : " start", prev, next);
-		binder_update_page_range(proc, 0, free_page_start ?
+		binder_free_page_range(proc, free_page_start ?
 			buffer_start_page(buffer) : buffer_end_page(buffer),
 			(free_page_end ? buffer_end_page(buffer) :
-			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+			buffer_start_page(buffer)) + PAGE_SIZE);
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void __binder_free_buf(struct binder_proc *proc,
+			      struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -897,10 +1356,9 @@ static void binder_free_buf(struct binder_proc *proc,
 			     proc->free_async_space);
 	}
 
-	binder_update_page_range(proc, 0,
+	binder_free_page_range(proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
-		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK));
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
@@ -923,6 +1381,147 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	binder_mutex_lock(&proc->alloc_lock);
+	__binder_free_buf(proc, buffer);
+	binder_mutex_unlock(&proc->alloc_lock);
+}
+
+/*
+ * Frees the buffers and the proc itself once no transaction is copying
+ * into them any more. Called with the main lock held.
+ */
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
+	binder_mutex_lock(&proc->alloc_lock);
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		t = buffer->transaction;
+		if (t) {
+			t->buffer = NULL;
+			buffer->transaction = NULL;
+			printk(KERN_ERR "binder: release proc %d, "
+			       "transaction %d, not freed\n",
+			       proc->pid, t->debug_id);
+			/*BUG();*/
+		}
+		__binder_free_buf(proc, buffer);
+		buffers++;
+	}
+
+	binder_stats_deleted(BINDER_STAT_PROC);
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+
+		spin_lock(&binder_lru_lock);
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (!list_empty(&proc->lru_pages[i].lru)) {
+				list_del_init(&proc->lru_pages[i].lru);
+				binder_lru_count--;
+			}
+		}
+		spin_unlock(&binder_lru_lock);
+
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (proc->pages[i]) {
+				void *page_addr = proc->buffer + i * PAGE_SIZE;
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "binder_release: %d: "
+					     "page %d at %p not freed\n",
+					     proc->pid, i,
+					     page_addr);
+				unmap_kernel_range((unsigned long)page_addr,
+					PAGE_SIZE);
+				__free_page(proc->pages[i]);
+				page_count++;
+			}
+		}
+		kfree(proc->lru_pages);
+		kfree(proc->pages);
+		vfree(proc->buffer);
+	}
+	/* Keep the shrinker off the pages until they are all gone */
+	binder_mutex_unlock(&proc->alloc_lock);
+	if (proc->vma_vm_mm)
+		mmdrop(proc->vma_vm_mm);
+
+	put_task_struct(proc->tsk);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	proc->tmp_ref--;
+	if (proc->is_dead && !proc->tmp_ref)
+		binder_free_proc(proc);
+}
+
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node->stats);
+	kfree(node);
+}
+
+/* Called when a thread of proc picks up t */
+static void binder_account_delivery(struct binder_proc *proc,
+				    struct binder_transaction *t)
+{
+	struct binder_node *node = t->buffer->target_node;
+	u64 now = binder_now();
+
+	if (node == NULL) {
+		/* a reply, the call it answers is complete */
+		binder_latency_add(&proc->call_latency, t->start_ns, now);
+		return;
+	}
+
+	t->wakeup_ns = now;
+	binder_latency_add(&proc->queue_latency, t->start_ns, now);
+
+	if (node->stats == NULL)
+		node->stats = kzalloc(sizeof(*node->stats), GFP_KERNEL);
+	if (node->stats == NULL)
+		return;
+	if (t->flags & TF_ONE_WAY)
+		node->stats->oneway_calls++;
+	else
+		node->stats->calls++;
+	binder_latency_add(&node->stats->queue, t->start_ns, now);
+}
+
+/* Called when proc replies to in_reply_to with t */
+static void binder_account_reply(struct binder_proc *proc,
+				 struct binder_transaction *in_reply_to,
+				 struct binder_transaction *t)
+{
+	struct binder_buffer *buffer = in_reply_to->buffer;
+	u64 now = binder_now();
+
+	t->start_ns = in_reply_to->start_ns;
+	binder_latency_add(&proc->service_latency, in_reply_to->wakeup_ns,
+			   now);
+
+	/* The node is only known while the buffer has not been freed */
+	if (buffer && buffer->target_node && buffer->target_node->stats)
+		binder_latency_add(&buffer->target_node->stats->service,
+				   in_reply_to->wakeup_ns, now);
+}
+
 static struct binder_node *binder_get_node(struct binder_proc *proc,
 					   void __user *ptr)
 {
@@ -973,6 +1572,8 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	node->ptr = ptr;
 	node->cookie = cookie;
 	node->work.type = BINDER_WORK_NODE;
+	node->sched_policy = SCHED_NORMAL;
+	node->min_priority = BINDER_NICE_TO_PRIO(0);
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
@@ -1052,7 +1653,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
-			kfree(node);
+			binder_free_node(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
 	}
@@ -1389,6 +1990,7 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_buffer *buffer;
 	uint32_t return_error;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
@@ -1408,7 +2010,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_set_priority(in_reply_to->saved_priority);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1481,21 +2083,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
 		}
 	}
-	if (target_thread) {
-		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1542,41 +2131,117 @@ static void binder_transaction(struct binder_proc *proc,
 	t->to_thread = target_thread;
 	t->code = tr->code;
 	t->flags = tr->flags;
-	t->priority = task_nice(current);
-	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
-	if (t->buffer == NULL) {
-		return_error = BR_FAILED_REPLY;
-		goto err_binder_alloc_buf_failed;
+	t->priority = binder_task_priority(current);
+	if (binder_is_rt_policy(t->priority.sched_policy) &&
+	    !binder_inherit_rt) {
+		t->priority.sched_policy = SCHED_NORMAL;
+		t->priority.prio = current->static_prio;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
+	t->start_ns = binder_now();
+
+	/*
+	 * Allocating the buffer may have to map pages into the target and
+	 * copying the data may fault, so both are done without the main
+	 * lock. The target proc and node are pinned until it is retaken,
+	 * and the buffer is not visible to anybody else until it is queued.
+	 */
+	target_proc->tmp_ref++;
 	if (target_node)
 		binder_inc_node(target_node, 1, 0, NULL);
+	binder_unlock();
 
-	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+	return_error = BR_OK;
+	buffer = binder_alloc_buf(target_proc, tr->data_size,
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+	if (buffer == NULL) {
 		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+	} else {
+		buffer->debug_id = t->debug_id;
+		buffer->target_node = target_node;
+		offp = (size_t *)(buffer->data +
+				  ALIGN(tr->data_size, sizeof(void *)));
+
+		if (copy_from_user(buffer->data, tr->data.ptr.buffer,
+				   tr->data_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid data ptr\n", proc->pid, thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (copy_from_user(offp, tr->data.ptr.offsets,
+					  tr->offsets_size)) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets ptr\n",
+				proc->pid, thread->pid);
+			return_error = BR_FAILED_REPLY;
+		} else if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
+			binder_user_error("binder: %d:%d got transaction with "
+				"invalid offsets size, %zd\n",
+				proc->pid, thread->pid, tr->offsets_size);
+			return_error = BR_FAILED_REPLY;
+		}
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
+
+	binder_lock();
+	if (target_proc->is_dead) {
+		/*
+		 * Released meanwhile. Its nodes dropped all local refs,
+		 * including ours, and may be gone: only free the buffer.
+		 */
+		if (buffer)
+			binder_free_buf(target_proc, buffer);
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_target_proc;
+	}
+	if (buffer == NULL) {
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
+		goto err_binder_alloc_buf_failed;
+	}
+	t->buffer = buffer;
+	buffer->transaction = t;
+	if (return_error != BR_OK)
 		goto err_copy_data_failed;
+
+	if (reply) {
+		/* Recheck the caller, it may have died meanwhile */
+		target_thread = in_reply_to->from;
+		if (target_thread == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_copy_data_failed;
+		}
+		if (target_thread->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				target_thread->transaction_stack ?
+				target_thread->transaction_stack->debug_id : 0,
+				in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			target_thread = NULL;
+			goto err_copy_data_failed;
+		}
+	} else if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
+		struct binder_transaction *tmp;
+
+		/* Threads on the stack may have exited, so look only now */
+		tmp = thread->transaction_stack;
+		while (tmp) {
+			if (tmp->from && tmp->from->proc == target_proc)
+				target_thread = tmp->from;
+			tmp = tmp->from_parent;
+		}
+		t->to_thread = target_thread;
 	}
-	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
-		binder_user_error("binder: %d:%d got transaction with "
-			"invalid offsets size, %zd\n",
-			proc->pid, thread->pid, tr->offsets_size);
-		return_error = BR_FAILED_REPLY;
-		goto err_bad_offset;
+	if (target_thread) {
+		e->to_thread = target_thread->pid;
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
 	}
+
 	off_end = (void *)offp + tr->offsets_size;
 	for (; offp < off_end; offp++) {
 		struct flat_binder_object *fp;
@@ -1601,7 +2266,25 @@ static void binder_transaction(struct binder_proc *proc,
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+				node->sched_policy = (fp->flags &
+					FLAT_BINDER_FLAG_SCHED_POLICY_MASK) >>
+					FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT;
+				if (!binder_is_rt_policy(node->sched_policy))
+					node->sched_policy = SCHED_NORMAL;
+				node->min_priority = binder_flags_to_prio(
+					node->sched_policy, fp->flags);
+				if (binder_is_rt_policy(node->sched_policy) &&
+				    !binder_can_use_rt_prio(node->min_priority)) {
+					binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+						     "binder: %d:%d node %d rt "
+						     "priority not allowed, use "
+						     "SCHED_NORMAL\n",
+						     proc->pid, thread->pid,
+						     node->debug_id);
+					node->sched_policy = SCHED_NORMAL;
+					node->min_priority =
+						BINDER_NICE_TO_PRIO(0);
+				}
 				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
@@ -1717,6 +2400,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		binder_account_reply(proc, in_reply_to, t);
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -1738,6 +2422,7 @@ static void binder_transaction(struct binder_proc *proc,
 	list_add_tail(&tcomplete->entry, &thread->todo);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
 err_get_unused_fd_failed:
@@ -1753,6 +2438,8 @@ err_copy_data_failed:
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
+err_dead_target_proc:
+	binder_proc_dec_tmpref(target_proc);
 	kfree(tcomplete);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 err_alloc_tcomplete_failed:
@@ -1775,7 +2462,14 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
+	if (thread->return_error != BR_OK) {
+		/*
+		 * A failed reply to an earlier transaction of ours may
+		 * have come in while the main lock was dropped.
+		 */
+		WARN_ON(thread->return_error2 != BR_OK);
+		thread->return_error2 = thread->return_error;
+	}
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
 		binder_send_failed_reply(in_reply_to, return_error);
@@ -1933,14 +2627,24 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			/*
+			 * Claim the buffer under the allocator lock, senders
+			 * change the tree without holding the main lock.
+			 */
+			binder_mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
+			if (buffer && buffer->allow_user_free)
+				buffer->allow_user_free = 0;
+			else if (buffer)
+				buffer = ERR_PTR(-EBUSY);
+			binder_mutex_unlock(&proc->alloc_lock);
 			if (buffer == NULL) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
-			if (!buffer->allow_user_free) {
+			if (IS_ERR(buffer)) {
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
@@ -2232,7 +2936,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2243,7 +2947,7 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
-		binder_set_nice(proc->default_priority);
+		binder_set_priority(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
 				ret = -EAGAIN;
@@ -2256,7 +2960,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock();
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2352,7 +3056,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
+					binder_free_node(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
 					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
@@ -2406,13 +3110,7 @@ retry:
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
-			t->saved_priority = task_nice(current);
-			if (t->priority < target_node->min_priority &&
-			    !(t->flags & TF_ONE_WAY))
-				binder_set_nice(t->priority);
-			else if (!(t->flags & TF_ONE_WAY) ||
-				 t->saved_priority > target_node->min_priority)
-				binder_set_nice(target_node->min_priority);
+			binder_transaction_priority(t, target_node);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2446,6 +3144,7 @@ retry:
 			return -EFAULT;
 		ptr += sizeof(tr);
 
+		binder_account_delivery(proc, t);
 		binder_stat_br(proc, thread, cmd);
 		binder_debug(BINDER_DEBUG_TRANSACTION,
 			     "binder: %d:%d %s %d %d:%d, cmd %d"
@@ -2598,12 +3297,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2635,7 +3334,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	binder_lock();
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2744,7 +3443,7 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2781,7 +3480,7 @@ static struct vm_operations_struct binder_vm_ops = {
 
 static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	int ret;
+	int i, ret;
 	struct vm_struct *area;
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
@@ -2832,12 +3531,22 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		failure_string = "alloc page array";
 		goto err_alloc_pages_failed;
 	}
+	proc->lru_pages = kzalloc(sizeof(proc->lru_pages[0]) * ((vma->vm_end - vma->vm_start) / PAGE_SIZE), GFP_KERNEL);
+	if (proc->lru_pages == NULL) {
+		ret = -ENOMEM;
+		failure_string = "alloc lru page array";
+		goto err_alloc_lru_pages_failed;
+	}
+	for (i = 0; i < (vma->vm_end - vma->vm_start) / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&proc->lru_pages[i].lru);
+		proc->lru_pages[i].proc = proc;
+	}
 	proc->buffer_size = vma->vm_end - vma->vm_start;
 
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
 
-	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
+	if (binder_alloc_page_range(proc, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
 		ret = -ENOMEM;
 		failure_string = "alloc small buf";
 		goto err_alloc_small_buf_failed;
@@ -2848,6 +3557,9 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	buffer->free = 1;
 	binder_insert_free_buffer(proc, buffer);
 	proc->free_async_space = proc->buffer_size / 2;
+	/* Pinned for the shrinker, which may run after the vma is gone */
+	proc->vma_vm_mm = vma->vm_mm;
+	atomic_inc(&vma->vm_mm->mm_count);
 	barrier();
 	proc->files = get_files_struct(current);
 	proc->vma = vma;
@@ -2857,6 +3569,9 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	return 0;
 
 err_alloc_small_buf_failed:
+	kfree(proc->lru_pages);
+	proc->lru_pages = NULL;
+err_alloc_lru_pages_failed:
 	kfree(proc->pages);
 	proc->pages = NULL;
 err_alloc_pages_failed:
@@ -2884,14 +3599,15 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
-	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_mutex_init(&proc->alloc_lock, &binder_alloc_lock_stats);
+	proc->default_priority = binder_task_priority(current);
+	binder_lock();
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock();
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2943,9 +3659,8 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
@@ -2974,7 +3689,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
-			kfree(node);
+			binder_free_node(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
 			struct binder_ref *ref;
@@ -3011,57 +3726,16 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
-
-	while ((n = rb_first(&proc->allocated_buffers))) {
-		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
-							rb_node);
-		t = buffer->transaction;
-		if (t) {
-			t->buffer = NULL;
-			buffer->transaction = NULL;
-			printk(KERN_ERR "binder: release proc %d, "
-			       "transaction %d, not freed\n",
-			       proc->pid, t->debug_id);
-			/*BUG();*/
-		}
-		binder_free_buf(proc, buffer);
-		buffers++;
-	}
-
-	binder_stats_deleted(BINDER_STAT_PROC);
-
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions);
 
-	kfree(proc);
+	proc->is_dead = 1;
+	if (!proc->tmp_ref)
+		binder_free_proc(proc);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3071,7 +3745,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock();
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3098,7 +3772,7 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_RELEASE)
 			binder_deferred_release(proc); /* frees proc */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3122,13 +3796,15 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
 	seq_printf(m,
-		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
+		   "%s %d: %p from %d:%d to %d:%d code %x flags %x "
+		   "pri %u:%d r%d",
 		   prefix, t->debug_id, t,
 		   t->from ? t->from->proc->pid : 0,
 		   t->from ? t->from->pid : 0,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
-		   t->code, t->flags, t->priority, t->need_reply);
+		   t->code, t->flags, t->priority.sched_policy,
+		   t->priority.prio, t->need_reply);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3279,9 +3955,13 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	if (!binder_debug_no_lock)
+		binder_mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	if (!binder_debug_no_lock)
+		binder_mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3383,6 +4063,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	struct binder_work *w;
 	struct rb_node *n;
 	int count, strong, weak;
+	int i, active, lru;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	count = 0;
@@ -3411,10 +4092,29 @@ static void print_binder_proc_stats(struct seq_file *m,
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	if (!binder_debug_no_lock)
+		binder_mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
 
+	active = 0;
+	lru = 0;
+	for (i = 0; proc->lru_pages && i < proc->buffer_size / PAGE_SIZE; i++) {
+		if (!proc->pages[i])
+			continue;
+		if (list_empty(&proc->lru_pages[i].lru))
+			active++;
+		else
+			lru++;
+	}
+	seq_printf(m, "  pages: %d active %d lru\n"
+			"  pages reused: %u\n"
+			"  pages reclaimed: %u\n", active, lru,
+			proc->pages_reused, proc->pages_reclaimed);
+	if (!binder_debug_no_lock)
+		binder_mutex_unlock(&proc->alloc_lock);
+
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
@@ -3439,7 +4139,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder state:\n");
 
@@ -3451,7 +4151,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3462,16 +4162,89 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder stats:\n");
 
 	print_binder_stats(m, "", &binder_stats);
+	seq_printf(m, "lru pages: %d\n", binder_lru_count);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
+	return 0;
+}
+
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency *lat)
+{
+	int i;
+
+	if (!lat->count)
+		return;
+
+	seq_printf(m, "%s: count %u avg %llu max %u us, buckets", prefix,
+		   lat->count, div_u64(lat->total_us, lat->count), lat->max_us);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (lat->buckets[i])
+			seq_printf(m, " %u:%u", i ? 1U << (i - 1) : 0,
+				   lat->buckets[i]);
+	}
+	seq_puts(m, "\n");
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		binder_lock();
+
+	seq_puts(m, "binder latency:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		if (!proc->call_latency.count && !proc->queue_latency.count)
+			continue;
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency(m, "  call", &proc->call_latency);
+		print_binder_latency(m, "  queue", &proc->queue_latency);
+		print_binder_latency(m, "  service", &proc->service_latency);
+	}
+	if (do_lock)
+		binder_unlock();
+	return 0;
+}
+
+static int binder_node_stats_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct binder_node *node;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+
+	if (do_lock)
+		binder_lock();
+
+	seq_puts(m, "binder node stats:\n");
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			node = rb_entry(n, struct binder_node, rb_node);
+			if (node->stats == NULL)
+				continue;
+			seq_printf(m, "node %d: proc %d u%p c%p calls %u "
+				   "oneway %u\n", node->debug_id, proc->pid,
+				   node->ptr, node->cookie, node->stats->calls,
+				   node->stats->oneway_calls);
+			print_binder_latency(m, "  queue", &node->stats->queue);
+			print_binder_latency(m, "  service",
+					     &node->stats->service);
+		}
+	}
+	if (do_lock)
+		binder_unlock();
 	return 0;
 }
 
@@ -3482,13 +4255,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
 	return 0;
 }
 
@@ -3498,11 +4271,38 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock();
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock();
+	return 0;
+}
+
+static void print_binder_lock_stats(struct seq_file *m, const char *name,
+				    struct binder_lock_stats *stats)
+{
+	struct binder_lock_stats s;
+
+	spin_lock(&stats->lock);
+	s = *stats;
+	spin_unlock(&stats->lock);
+
+	seq_printf(m, "%s: acquired %llu contended %llu\n"
+		   "  wait %llu us max %llu us\n"
+		   "  hold %llu us max %llu us\n",
+		   name, s.acquired, s.contended,
+		   div_u64(s.wait_ns, NSEC_PER_USEC),
+		   div_u64(s.max_wait_ns, NSEC_PER_USEC),
+		   div_u64(s.hold_ns, NSEC_PER_USEC),
+		   div_u64(s.max_hold_ns, NSEC_PER_USEC));
+}
+
+static int binder_lock_stats_show(struct seq_file *m, void *unused)
+{
+	seq_puts(m, "binder lock stats:\n");
+	print_binder_lock_stats(m, "main", &binder_main_lock_stats);
+	print_binder_lock_stats(m, "alloc", &binder_alloc_lock_stats);
 	return 0;
 }
 
@@ -3551,6 +4351,9 @@ BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
 BINDER_DEBUG_ENTRY(transaction_log);
+BINDER_DEBUG_ENTRY(lock_stats);
+BINDER_DEBUG_ENTRY(latency);
+BINDER_DEBUG_ENTRY(node_stats);
 
 static int __init binder_init(void)
 {
@@ -3565,6 +4368,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
@@ -3591,6 +4395,21 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    &binder_transaction_log_failed,
 				    &binder_transaction_log_fops);
+		debugfs_create_file("lock_stats",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_lock_stats_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
+		debugfs_create_file("node_stats",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_node_stats_fops);
 	}
 	return ret;
 }
@@ -37,6 +37,16 @@ enum {
 enum {
 	FLAT_BINDER_FLAG_PRIORITY_MASK = 0xff,
 	FLAT_BINDER_FLAG_ACCEPTS_FDS = 0x100,
+	/*
+	 * Scheduling policy of the node's minimum priority: SCHED_NORMAL
+	 * (the default, priority is a nice value), SCHED_FIFO or SCHED_RR
+	 * (priority is an rt priority, 1 to 99).  An rt policy is only
+	 * kept if the process publishing the node has CAP_SYS_NICE or an
+	 * RLIMIT_RTPRIO covering the priority; otherwise the node gets
+	 * SCHED_NORMAL.
+	 */
+	FLAT_BINDER_FLAG_SCHED_POLICY_MASK = 0x600,
+	FLAT_BINDER_FLAG_SCHED_POLICY_SHIFT = 9,
 };
 
 /*
@@ -16,6 +16,20 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Processes are kept in an index bucketed by oom_adj, updated on fork, exit
+ * and oom_adj writes, so picking a victim only looks at the highest
+ * populated buckets at or above the selected minimum oom_adj instead of
+ * walking the whole task list. Shrinker and kill counters can be read from
+ * /sys/module/lowmemorykiller/parameters/stats and .../kills.
+ *
+ * With pressure_mode set, the driver also samples vmscan reclaim efficiency
+ * (pages reclaimed per page scanned) and direct reclaim stalls over a
+ * sliding window, and turns them into a pressure level of none, low, medium
+ * or critical. Each level above none selects an entry of the adj table,
+ * counting from the least important end, and the free memory thresholds
+ * only remain in force for the first pressure_floor entries. The current
+ * level can be read, and polled for changes, at .../parameters/pressure.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -35,6 +49,13 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/vmstat.h>
+#include <linux/swap.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +76,73 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+#define LOWMEM_ADJ_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+#define lowmem_bucket(adj)	((adj) - OOM_DISABLE)
+
+/*
+ * Thread groups, linked through signal_struct->lowmem_node, bucketed by
+ * oom_adj. Protected by lowmem_index_lock, which nests outside task_lock().
+ */
+static struct list_head lowmem_index[LOWMEM_ADJ_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_index_lock);
+static bool lowmem_index_ready;
+
+static struct lowmem_stats {
+	atomic_t shrink_calls;	/* shrinker invocations */
+	u32 scans;		/* invocations that looked for a victim */
+	u32 scan_tasks;		/* thread groups examined */
+	u64 scan_ns;		/* time spent looking for victims */
+	u32 kills[LOWMEM_ADJ_BUCKETS];
+} lowmem_stats;
+
+enum {
+	LOWMEM_PRESSURE_NONE,
+	LOWMEM_PRESSURE_LOW,
+	LOWMEM_PRESSURE_MEDIUM,
+	LOWMEM_PRESSURE_CRITICAL,
+	LOWMEM_PRESSURE_LEVELS,
+};
+
+static const char * const lowmem_pressure_names[] = {
+	"none", "low", "medium", "critical",
+};
+
+#define LOWMEM_PRESSURE_SAMPLES		8
+/* shortest sampling interval, so that the sampler cannot spin */
+#define LOWMEM_PRESSURE_MIN_INTERVAL_MS	10
+/* below this many pages scanned per window, reclaim is not under pressure */
+#define LOWMEM_PRESSURE_MIN_SCAN	(SWAP_CLUSTER_MAX * 16)
+
+static bool lowmem_pressure_mode;
+static unsigned int lowmem_pressure_interval_ms = 100;
+static unsigned int lowmem_pressure_stall_weight = 10;
+static int lowmem_pressure_floor = 1;
+static int lowmem_pressure_thresholds[LOWMEM_PRESSURE_LEVELS - 1] = {
+	30,
+	60,
+	95,
+};
+static int lowmem_pressure_thresholds_size = LOWMEM_PRESSURE_LEVELS - 1;
+
+struct lowmem_pressure_sample {
+	unsigned long scanned;
+	unsigned long reclaimed;
+	unsigned long stalls;
+};
+
+/* Only touched by lowmem_pressure_work, apart from 'level' and 'pressure' */
+static struct lowmem_pressure {
+	struct lowmem_pressure_sample window[LOWMEM_PRESSURE_SAMPLES];
+	struct lowmem_pressure_sample last;
+	int next;
+	int pressure;		/* 0..100 */
+	int level;
+	struct kobject *kobj;	/* for sysfs_notify() on level changes */
+} lowmem_pressure;
+
+static void lowmem_pressure_fn(struct work_struct *work);
+static DECLARE_DEFERRED_WORK(lowmem_pressure_work, lowmem_pressure_fn);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -79,21 +167,235 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+static inline struct list_head *lowmem_sig_bucket(struct signal_struct *sig)
+{
+	int adj = clamp(sig->oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+
+	return &lowmem_index[lowmem_bucket(adj)];
+}
+
+void lowmem_index_add(struct task_struct *p)
+{
+	struct signal_struct *sig = p->signal;
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready && list_empty(&sig->lowmem_node))
+		list_add_tail(&sig->lowmem_node, lowmem_sig_bucket(sig));
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_index_del(struct task_struct *p)
+{
+	struct signal_struct *sig = p->signal;
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready)
+		list_del_init(&sig->lowmem_node);
+	spin_unlock(&lowmem_index_lock);
+}
+
+void lowmem_index_update(struct task_struct *p)
+{
+	struct signal_struct *sig = p->signal;
+
+	spin_lock(&lowmem_index_lock);
+	if (lowmem_index_ready && !list_empty(&sig->lowmem_node))
+		list_move_tail(&sig->lowmem_node, lowmem_sig_bucket(sig));
+	spin_unlock(&lowmem_index_lock);
+}
+
+/*
+ * Pick the largest thread group in the highest populated oom_adj bucket at
+ * or above min_adj. Returns the victim with a reference held, or NULL.
+ */
+static struct task_struct *lowmem_select(int min_adj, int *selected_size,
+					 int *selected_adj)
 {
-	struct task_struct *p;
 	struct task_struct *selected = NULL;
+	struct signal_struct *sig;
+	int selected_tasksize = 0;
+	int adj;
+
+	min_adj = max(min_adj, OOM_DISABLE);
+
+	rcu_read_lock();
+	spin_lock(&lowmem_index_lock);
+	lowmem_stats.scans++;
+	for (adj = OOM_ADJUST_MAX; adj >= min_adj && !selected; adj--) {
+		list_for_each_entry(sig, &lowmem_index[lowmem_bucket(adj)],
+				    lowmem_node) {
+			struct task_struct *p;
+			struct mm_struct *mm;
+			int tasksize;
+
+			p = pid_task(sig->leader_pid, PIDTYPE_PID);
+			if (!p)
+				continue;
+			lowmem_stats.scan_tasks++;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+			if (selected && tasksize <= selected_tasksize)
+				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n",
+				     p->pid, p->comm, adj, tasksize);
+		}
+		if (selected)
+			*selected_adj = adj;
+	}
+	if (selected) {
+		get_task_struct(selected);
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
+		lowmem_stats.kills[lowmem_bucket(*selected_adj)]++;
+		*selected_size = selected_tasksize;
+	}
+	spin_unlock(&lowmem_index_lock);
+	rcu_read_unlock();
+
+	return selected;
+}
+
+static void lowmem_read_vm_events(struct lowmem_pressure_sample *sample)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	int cpu, zone;
+
+	memset(sample, 0, sizeof(*sample));
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			int off = zone - ZONE_NORMAL;
+
+			sample->scanned +=
+				this->event[PGSCAN_KSWAPD_NORMAL + off] +
+				this->event[PGSCAN_DIRECT_NORMAL + off];
+			sample->reclaimed += this->event[PGSTEAL_NORMAL + off];
+		}
+		sample->stalls += this->event[ALLOCSTALL];
+	}
+	put_online_cpus();
+#else
+	memset(sample, 0, sizeof(*sample));
+#endif
+}
+
+/*
+ * Pressure is the share of scanned pages that reclaim failed to free over
+ * the window, plus a fixed penalty for each direct reclaim stall, capped
+ * at 100.
+ */
+static int lowmem_pressure_calc(void)
+{
+	unsigned long scanned = 0, reclaimed = 0, stalls = 0;
+	unsigned long pressure = 0;
+	int i;
+
+	for (i = 0; i < LOWMEM_PRESSURE_SAMPLES; i++) {
+		scanned += lowmem_pressure.window[i].scanned;
+		reclaimed += lowmem_pressure.window[i].reclaimed;
+		stalls += lowmem_pressure.window[i].stalls;
+	}
+
+	if (scanned >= LOWMEM_PRESSURE_MIN_SCAN && reclaimed < scanned)
+		pressure = 100 - reclaimed * 100 / scanned;
+	pressure += stalls * lowmem_pressure_stall_weight;
+
+	return min_t(unsigned long, pressure, 100);
+}
+
+static void lowmem_pressure_fn(struct work_struct *work)
+{
+	struct lowmem_pressure_sample now, *sample;
+	int level = LOWMEM_PRESSURE_NONE;
+	int pressure;
+	int i;
+
+	lowmem_read_vm_events(&now);
+	sample = &lowmem_pressure.window[lowmem_pressure.next];
+	sample->scanned = now.scanned - lowmem_pressure.last.scanned;
+	sample->reclaimed = now.reclaimed - lowmem_pressure.last.reclaimed;
+	sample->stalls = now.stalls - lowmem_pressure.last.stalls;
+	lowmem_pressure.last = now;
+	lowmem_pressure.next = (lowmem_pressure.next + 1) %
+			       LOWMEM_PRESSURE_SAMPLES;
+
+	pressure = lowmem_pressure_calc();
+	for (i = 0; i < lowmem_pressure_thresholds_size; i++)
+		if (pressure >= lowmem_pressure_thresholds[i])
+			level = i + 1;
+
+	lowmem_pressure.pressure = pressure;
+	if (level != lowmem_pressure.level) {
+		lowmem_print(3, "lowmem pressure %s -> %s (%d)\n",
+			     lowmem_pressure_names[lowmem_pressure.level],
+			     lowmem_pressure_names[level], pressure);
+		lowmem_pressure.level = level;
+		if (lowmem_pressure.kobj)
+			sysfs_notify(lowmem_pressure.kobj, "parameters",
+				     "pressure");
+	}
+
+	if (lowmem_pressure_mode)
+		schedule_delayed_work(&lowmem_pressure_work,
+			msecs_to_jiffies(lowmem_pressure_interval_ms));
+}
+
+static void lowmem_pressure_start(void)
+{
+	memset(lowmem_pressure.window, 0, sizeof(lowmem_pressure.window));
+	lowmem_read_vm_events(&lowmem_pressure.last);
+	lowmem_pressure.pressure = 0;
+	lowmem_pressure.level = LOWMEM_PRESSURE_NONE;
+	schedule_delayed_work(&lowmem_pressure_work,
+			      msecs_to_jiffies(lowmem_pressure_interval_ms));
+}
+
+/*
+ * The pressure level picks an adj table entry counting back from the last
+ * (least important) one: low kills from lowmem_adj[size - 1], medium from
+ * lowmem_adj[size - 2] and so on.
+ */
+static int lowmem_pressure_min_adj(int array_size)
+{
+	int level = lowmem_pressure.level;
+
+	if (level == LOWMEM_PRESSURE_NONE || !array_size)
+		return OOM_ADJUST_MAX + 1;
+
+	return lowmem_adj[max(array_size - level, 0)];
+}
+
+static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
+{
+	struct task_struct *selected;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
+	int selected_oom_adj = 0;
+	ktime_t start;
 	int array_size = ARRAY_SIZE(lowmem_adj);
+	int table_size;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
 
+	atomic_inc(&lowmem_stats.shrink_calls);
+
 	/*
 	 * If we already have a death outstanding, then
 	 * bail out right away; indicating to vmscan
@@ -109,13 +411,18 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 		array_size = lowmem_adj_size;
 	if (lowmem_minfree_size < array_size)
 		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
+	table_size = array_size;
+	if (lowmem_pressure_mode)
+		table_size = clamp(lowmem_pressure_floor, 0, array_size);
+	for (i = 0; i < table_size; i++) {
 		if (other_free < lowmem_minfree[i] &&
 		    other_file < lowmem_minfree[i]) {
 			min_adj = lowmem_adj[i];
 			break;
 		}
 	}
+	if (lowmem_pressure_mode)
+		min_adj = min(min_adj, lowmem_pressure_min_adj(array_size));
 	if (sc->nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d\n",
 			     sc->nr_to_scan, sc->gfp_mask, other_free, other_file,
@@ -129,55 +436,23 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     sc->nr_to_scan, sc->gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
+	start = ktime_get();
+	selected = lowmem_select(min_adj, &selected_tasksize,
+				 &selected_oom_adj);
+	spin_lock(&lowmem_index_lock);
+	lowmem_stats.scan_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	spin_unlock(&lowmem_index_lock);
 
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
 			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
+		send_sig(SIGKILL, selected, 0);
+		put_task_struct(selected);
 		rem -= selected_tasksize;
 	}
 	lowmem_print(4, "lowmem_shrink %lu, %x, return %d\n",
 		     sc->nr_to_scan, sc->gfp_mask, rem);
-	read_unlock(&tasklist_lock);
 	return rem;
 }
 
@@ -186,15 +461,156 @@ static struct shrinker lowmem_shrinker = {
 	.seeks = DEFAULT_SEEKS * 16
 };
 
+static int lowmem_stats_get(char *buffer, const struct kernel_param *kp)
+{
+	u32 scans, scan_tasks;
+	u64 scan_ns;
+
+	spin_lock(&lowmem_index_lock);
+	scans = lowmem_stats.scans;
+	scan_tasks = lowmem_stats.scan_tasks;
+	scan_ns = lowmem_stats.scan_ns;
+	spin_unlock(&lowmem_index_lock);
+
+	return sprintf(buffer, "shrink_calls %u\nscans %u\nscan_tasks %u\n"
+		       "scan_us %llu",
+		       atomic_read(&lowmem_stats.shrink_calls),
+		       scans, scan_tasks,
+		       (unsigned long long)div_u64(scan_ns, NSEC_PER_USEC));
+}
+
+static struct kernel_param_ops lowmem_stats_ops = {
+	.get = lowmem_stats_get,
+};
+
+static int lowmem_kills_get(char *buffer, const struct kernel_param *kp)
+{
+	int len = 0;
+	int adj;
+
+	spin_lock(&lowmem_index_lock);
+	for (adj = OOM_DISABLE; adj <= OOM_ADJUST_MAX; adj++) {
+		u32 kills = lowmem_stats.kills[lowmem_bucket(adj)];
+
+		if (kills)
+			len += sprintf(buffer + len, "%s%d:%u",
+				       len ? "," : "", adj, kills);
+	}
+	spin_unlock(&lowmem_index_lock);
+
+	return len;
+}
+
+static struct kernel_param_ops lowmem_kills_ops = {
+	.get = lowmem_kills_get,
+};
+
+static int lowmem_pressure_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%s %d",
+		       lowmem_pressure_names[lowmem_pressure.level],
+		       lowmem_pressure.pressure);
+}
+
+static struct kernel_param_ops lowmem_pressure_ops = {
+	.get = lowmem_pressure_get,
+};
+
+static int lowmem_pressure_mode_set(const char *val,
+				    const struct kernel_param *kp)
+{
+	bool was = lowmem_pressure_mode;
+	int ret;
+
+	ret = param_set_bool(val, kp);
+	if (ret)
+		return ret;
+
+	/* set on the command line; lowmem_init() will start the sampler */
+	if (!lowmem_index_ready)
+		return 0;
+
+	if (lowmem_pressure_mode && !was) {
+		lowmem_pressure_start();
+	} else if (!lowmem_pressure_mode && was) {
+		cancel_delayed_work_sync(&lowmem_pressure_work);
+		lowmem_pressure.pressure = 0;
+		lowmem_pressure.level = LOWMEM_PRESSURE_NONE;
+		if (lowmem_pressure.kobj)
+			sysfs_notify(lowmem_pressure.kobj, "parameters",
+				     "pressure");
+	}
+
+	return 0;
+}
+
+static struct kernel_param_ops lowmem_pressure_mode_ops = {
+	.set = lowmem_pressure_mode_set,
+	.get = param_get_bool,
+};
+
+static int lowmem_pressure_interval_set(const char *val,
+					const struct kernel_param *kp)
+{
+	unsigned int ms;
+	int ret;
+
+	ret = kstrtouint(val, 0, &ms);
+	if (ret)
+		return ret;
+	if (ms < LOWMEM_PRESSURE_MIN_INTERVAL_MS)
+		return -EINVAL;
+
+	lowmem_pressure_interval_ms = ms;
+	return 0;
+}
+
+static struct kernel_param_ops lowmem_pressure_interval_ops = {
+	.set = lowmem_pressure_interval_set,
+	.get = param_get_uint,
+};
+
 static int __init lowmem_init(void)
 {
+	struct task_struct *p;
+	int i;
+
+	for (i = 0; i < LOWMEM_ADJ_BUCKETS; i++)
+		INIT_LIST_HEAD(&lowmem_index[i]);
+
+	/*
+	 * Index everything that was forked before we got here. Forks and
+	 * exits racing with this are resolved by the list_empty() checks in
+	 * lowmem_index_add() and lowmem_index_del().
+	 */
+	read_lock(&tasklist_lock);
+	spin_lock(&lowmem_index_lock);
+	for_each_process(p) {
+		struct signal_struct *sig = p->signal;
+
+		list_add_tail(&sig->lowmem_node, lowmem_sig_bucket(sig));
+	}
+	lowmem_index_ready = true;
+	spin_unlock(&lowmem_index_lock);
+	read_unlock(&tasklist_lock);
+
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+
+#ifdef CONFIG_SYSFS
+	lowmem_pressure.kobj = kset_find_obj(module_kset, KBUILD_MODNAME);
+#endif
+	if (lowmem_pressure_mode)
+		lowmem_pressure_start();
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	lowmem_pressure_mode = false;
+	cancel_delayed_work_sync(&lowmem_pressure_work);
+	if (lowmem_pressure.kobj)
+		kobject_put(lowmem_pressure.kobj);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -205,6 +621,19 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_cb(stats, &lowmem_stats_ops, NULL, S_IRUGO);
+module_param_cb(kills, &lowmem_kills_ops, NULL, S_IRUGO);
+module_param_cb(pressure_mode, &lowmem_pressure_mode_ops,
+		&lowmem_pressure_mode, S_IRUGO | S_IWUSR);
+module_param_cb(pressure, &lowmem_pressure_ops, NULL, S_IRUGO);
+module_param_cb(pressure_interval_ms, &lowmem_pressure_interval_ops,
+		&lowmem_pressure_interval_ms, S_IRUGO | S_IWUSR);
+module_param_named(pressure_stall_weight, lowmem_pressure_stall_weight, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_floor, lowmem_pressure_floor, int,
+		   S_IRUGO | S_IWUSR);
+module_param_array_named(pressure_thresholds, lowmem_pressure_thresholds, int,
+			 &lowmem_pressure_thresholds_size, S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
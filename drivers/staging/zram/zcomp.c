@@ -0,0 +1,412 @@
+/*
+ * Compression stream management for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Writers used to share a single workmem/buffer pair and were therefore
+ * serialized on the device lock for the whole duration of compression.
+ * Here each device keeps a small pool of streams instead: a writer grabs
+ * an idle stream, allocates a new one if the pool is below its limit, or
+ * sleeps until another writer releases one.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zcomp.h"
+#include "zcomp_lzo.h"
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+#include "zcomp_lz4.h"
+#endif
+#ifdef CONFIG_ZRAM_DEFLATE_COMPRESS
+#include "zcomp_deflate.h"
+#endif
+
+static struct zcomp_backend *backends[] = {
+	[ZCOMP_LZO] = &zcomp_lzo,
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	[ZCOMP_LZ4] = &zcomp_lz4,
+#endif
+#ifdef CONFIG_ZRAM_DEFLATE_COMPRESS
+	[ZCOMP_DEFLATE] = &zcomp_deflate,
+#endif
+};
+
+static void zcomp_strm_free(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	if (zstrm->private)
+		comp->backend->destroy(zstrm->private);
+	free_pages((unsigned long)zstrm->buffer, 1);
+	kfree(zstrm);
+}
+
+/*
+ * May be called from the I/O path, so do not recurse into the block
+ * layer while allocating. Backends whose create() cannot guarantee
+ * that set prealloc_strm and only get here from process context.
+ */
+static struct zcomp_strm *zcomp_strm_alloc(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = kzalloc(sizeof(*zstrm), GFP_NOIO);
+	if (!zstrm)
+		return NULL;
+
+	zstrm->private = comp->backend->create();
+
+	/*
+	 * Allocate 2 pages: 1 for compressed data, plus 1 extra for the
+	 * case when compressed size is larger than the original one.
+	 */
+	zstrm->buffer = (void *)__get_free_pages(GFP_NOIO | __GFP_ZERO, 1);
+	if (!zstrm->private || !zstrm->buffer) {
+		zcomp_strm_free(comp, zstrm);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&zstrm->list);
+	INIT_LIST_HEAD(&zstrm->node);
+
+	return zstrm;
+}
+
+/* Whether a writer may allocate a new stream, strm_lock held */
+static int zcomp_strm_can_grow(struct zcomp *comp)
+{
+	return !comp->backend->prealloc_strm &&
+		comp->avail_strm < comp->max_strm;
+}
+
+static int zcomp_strm_available(struct zcomp *comp)
+{
+	int ret;
+
+	spin_lock(&comp->strm_lock);
+	ret = !list_empty(&comp->idle_strm) || zcomp_strm_can_grow(comp);
+	spin_unlock(&comp->strm_lock);
+
+	return ret;
+}
+
+/* Allocate a stream and add it to the idle ones, process context only */
+static int zcomp_strm_add(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm;
+
+	zstrm = zcomp_strm_alloc(comp);
+	if (!zstrm)
+		return -ENOMEM;
+
+	spin_lock(&comp->strm_lock);
+	zstrm->id = comp->next_id++;
+	list_add(&zstrm->list, &comp->idle_strm);
+	list_add(&zstrm->node, &comp->strm_list);
+	comp->avail_strm++;
+	spin_unlock(&comp->strm_lock);
+	wake_up(&comp->strm_wait);
+
+	return 0;
+}
+
+/* Top a prealloc_strm pool up to max_strm, process context only */
+static void zcomp_strm_fill(struct zcomp *comp)
+{
+	int missing;
+
+	spin_lock(&comp->strm_lock);
+	missing = comp->max_strm - comp->avail_strm;
+	spin_unlock(&comp->strm_lock);
+
+	while (missing-- > 0)
+		if (zcomp_strm_add(comp))
+			break;
+}
+
+/*
+ * Get an idle stream, allocate a new one if the pool has not reached
+ * its limit yet, or sleep until another writer releases a stream.
+ */
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp)
+{
+	int contended = 0;
+	struct zcomp_strm *zstrm;
+
+	while (1) {
+		spin_lock(&comp->strm_lock);
+		if (!list_empty(&comp->idle_strm)) {
+			zstrm = list_first_entry(&comp->idle_strm,
+					struct zcomp_strm, list);
+			list_del_init(&zstrm->list);
+			zstrm->nr_used++;
+			if (contended)
+				zstrm->nr_contended++;
+			spin_unlock(&comp->strm_lock);
+			return zstrm;
+		}
+
+		if (!zcomp_strm_can_grow(comp)) {
+			spin_unlock(&comp->strm_lock);
+			contended = 1;
+			wait_event(comp->strm_wait,
+				zcomp_strm_available(comp));
+			continue;
+		}
+
+		/* Reserve the slot before dropping the lock to allocate */
+		comp->avail_strm++;
+		spin_unlock(&comp->strm_lock);
+
+		zstrm = zcomp_strm_alloc(comp);
+
+		spin_lock(&comp->strm_lock);
+		if (unlikely(!zstrm)) {
+			/*
+			 * Out of memory: give the slot back and wait for
+			 * one of the existing streams instead. There is
+			 * always at least one unless this is the first.
+			 */
+			comp->avail_strm--;
+			spin_unlock(&comp->strm_lock);
+			if (!comp->avail_strm)
+				return NULL;
+			contended = 1;
+			wait_event(comp->strm_wait,
+				!list_empty(&comp->idle_strm));
+			continue;
+		}
+		zstrm->id = comp->next_id++;
+		zstrm->nr_used = 1;
+		zstrm->nr_contended = contended;
+		list_add_tail(&zstrm->node, &comp->strm_list);
+		spin_unlock(&comp->strm_lock);
+		return zstrm;
+	}
+}
+
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm)
+{
+	spin_lock(&comp->strm_lock);
+	if (comp->avail_strm <= comp->max_strm) {
+		list_add(&zstrm->list, &comp->idle_strm);
+		spin_unlock(&comp->strm_lock);
+		wake_up(&comp->strm_wait);
+		return;
+	}
+
+	/* The limit was lowered while this stream was in use */
+	comp->avail_strm--;
+	list_del(&zstrm->node);
+	spin_unlock(&comp->strm_lock);
+	zcomp_strm_free(comp, zstrm);
+}
+
+/*
+ * Change the stream limit. Surplus idle streams are freed right away,
+ * busy ones when their writers release them. For prealloc_strm
+ * backends, the streams for a raised limit are allocated here; if that
+ * fails the device carries on with the streams it has.
+ */
+int zcomp_set_max_streams(struct zcomp *comp, int max_strm)
+{
+	struct zcomp_strm *zstrm, *tmp;
+	LIST_HEAD(victims);
+
+	if (max_strm < 1)
+		return -EINVAL;
+
+	spin_lock(&comp->strm_lock);
+	comp->max_strm = max_strm;
+	list_for_each_entry_safe(zstrm, tmp, &comp->idle_strm, list) {
+		if (comp->avail_strm <= comp->max_strm)
+			break;
+		list_del(&zstrm->list);
+		list_del(&zstrm->node);
+		list_add(&zstrm->list, &victims);
+		comp->avail_strm--;
+	}
+	spin_unlock(&comp->strm_lock);
+
+	list_for_each_entry_safe(zstrm, tmp, &victims, list)
+		zcomp_strm_free(comp, zstrm);
+
+	if (comp->backend->prealloc_strm)
+		zcomp_strm_fill(comp);
+
+	/* Writers may be waiting for a limit that just went up */
+	wake_up_all(&comp->strm_wait);
+
+	return 0;
+}
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len)
+{
+	return comp->backend->compress(src, zstrm->buffer, dst_len,
+					zstrm->private);
+}
+
+/* Never sleeps: callers may hold the table lock */
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	int ret;
+
+	if (!comp->dctx)
+		return comp->backend->decompress(src, src_len, dst, NULL);
+
+	ret = comp->backend->decompress(src, src_len, dst,
+				*per_cpu_ptr(comp->dctx, get_cpu()));
+	put_cpu();
+
+	return ret;
+}
+
+/* Lists available backends, the one named @comp in brackets */
+ssize_t zcomp_available_show(const char *comp, char *buf)
+{
+	ssize_t sz = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (!strcmp(comp, backends[i]->name))
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"[%s] ", backends[i]->name);
+		else
+			sz += scnprintf(buf + sz, PAGE_SIZE - sz - 2,
+					"%s ", backends[i]->name);
+	}
+	sz += scnprintf(buf + sz, PAGE_SIZE - sz, "\n");
+
+	return sz;
+}
+
+int zcomp_backend_id(const char *comp)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(backends); i++) {
+		if (sysfs_streq(comp, backends[i]->name))
+			return i;
+	}
+
+	return -EINVAL;
+}
+
+const char *zcomp_backend_name(int id)
+{
+	return backends[id]->name;
+}
+
+/* Returns the canonical name of backend @comp, NULL if unknown */
+const char *zcomp_lookup(const char *comp)
+{
+	int id = zcomp_backend_id(comp);
+
+	return id < 0 ? NULL : backends[id]->name;
+}
+
+ssize_t zcomp_strm_stats(struct zcomp *comp, char *buf, size_t len)
+{
+	ssize_t sz = 0;
+	struct zcomp_strm *zstrm;
+
+	spin_lock(&comp->strm_lock);
+	list_for_each_entry(zstrm, &comp->strm_list, node) {
+		sz += scnprintf(buf + sz, len - sz,
+			"stream%d: used %llu contended %llu%s\n",
+			zstrm->id, zstrm->nr_used, zstrm->nr_contended,
+			list_empty(&zstrm->list) ? " busy" : "");
+	}
+	spin_unlock(&comp->strm_lock);
+
+	return sz;
+}
+
+void zcomp_destroy(struct zcomp *comp)
+{
+	struct zcomp_strm *zstrm, *tmp;
+	int cpu;
+
+	list_for_each_entry_safe(zstrm, tmp, &comp->strm_list, node) {
+		list_del(&zstrm->node);
+		zcomp_strm_free(comp, zstrm);
+	}
+
+	if (comp->dctx) {
+		for_each_possible_cpu(cpu) {
+			void *private = *per_cpu_ptr(comp->dctx, cpu);
+
+			if (private)
+				comp->backend->destroy(private);
+		}
+		free_percpu(comp->dctx);
+	}
+	kfree(comp);
+}
+
+/*
+ * One stream is allocated up front so that a device is always able to
+ * make forward progress, even when memory is too low to add more; all
+ * of them for prealloc_strm backends, as long as memory allows.
+ */
+struct zcomp *zcomp_create(const char *compress, int max_strm)
+{
+	struct zcomp *comp;
+	int id, cpu;
+
+	id = zcomp_backend_id(compress);
+	if (id < 0 || max_strm < 1)
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	comp->backend = backends[id];
+	comp->id = id;
+
+	spin_lock_init(&comp->strm_lock);
+	INIT_LIST_HEAD(&comp->idle_strm);
+	INIT_LIST_HEAD(&comp->strm_list);
+	init_waitqueue_head(&comp->strm_wait);
+	comp->max_strm = max_strm;
+
+	if (zcomp_strm_add(comp)) {
+		kfree(comp);
+		return NULL;
+	}
+	if (comp->backend->prealloc_strm)
+		zcomp_strm_fill(comp);
+
+	if (comp->backend->decompress_ctx) {
+		comp->dctx = alloc_percpu(void *);
+		if (!comp->dctx)
+			goto fail;
+		for_each_possible_cpu(cpu) {
+			void *private = comp->backend->create();
+
+			if (!private)
+				goto fail;
+			*per_cpu_ptr(comp->dctx, cpu) = private;
+		}
+	}
+
+	return comp;
+
+fail:
+	zcomp_destroy(comp);
+	return NULL;
+}
@@ -0,0 +1,113 @@
+/*
+ * Compression stream management for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZCOMP_H_
+#define _ZCOMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+/*
+ * A compression stream: backend private data (working memory) plus an
+ * output buffer large enough for the worst case expansion of a single
+ * page. A writer owns a stream exclusively between zcomp_strm_find()
+ * and zcomp_strm_release().
+ */
+struct zcomp_strm {
+	void *private;
+	void *buffer;
+	int id;
+	struct list_head list;	/* entry in zcomp->idle_strm */
+	struct list_head node;	/* entry in zcomp->strm_list */
+
+	/* stats, protected by zcomp->strm_lock */
+	u64 nr_used;		/* no. of times this stream was handed out */
+	u64 nr_contended;	/* --do-- after the writer had to wait */
+};
+
+/* static compression backend */
+struct zcomp_backend {
+	int (*compress)(const unsigned char *src, unsigned char *dst,
+			size_t *dst_len, void *private);
+
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, void *private);
+
+	void *(*create)(void);
+	void (*destroy)(void *private);
+
+	/*
+	 * Set if decompress() also needs a private context. Reads run in
+	 * atomic context and cannot wait for a stream, so such backends
+	 * get one extra context per CPU for decompression.
+	 */
+	int decompress_ctx;
+
+	/*
+	 * Set if create() cannot be called on the write path, e.g. because
+	 * it allocates with GFP_KERNEL and could recurse into reclaim and
+	 * swap back into zram. Such backends get all their streams when
+	 * the device is set up or the limit is raised, never on demand.
+	 */
+	int prealloc_strm;
+
+	const char *name;
+};
+
+/* Backends in the order zcomp_available_show() lists them */
+enum zcomp_backend_id {
+	ZCOMP_LZO,
+#ifdef CONFIG_ZRAM_LZ4_COMPRESS
+	ZCOMP_LZ4,
+#endif
+#ifdef CONFIG_ZRAM_DEFLATE_COMPRESS
+	ZCOMP_DEFLATE,
+#endif
+	__NR_ZCOMP_BACKENDS,
+};
+
+struct zcomp {
+	struct zcomp_backend *backend;
+	enum zcomp_backend_id id;
+	void * __percpu *dctx;		/* per-CPU decompression contexts */
+	spinlock_t strm_lock;		/* protects lists, counters and stats */
+	struct list_head idle_strm;	/* streams ready for use */
+	struct list_head strm_list;	/* all allocated streams */
+	wait_queue_head_t strm_wait;	/* writers waiting for a stream */
+	int avail_strm;			/* no. of allocated streams */
+	int max_strm;			/* upper limit for avail_strm */
+	int next_id;
+};
+
+ssize_t zcomp_available_show(const char *comp, char *buf);
+const char *zcomp_lookup(const char *comp);
+int zcomp_backend_id(const char *comp);
+const char *zcomp_backend_name(int id);
+
+struct zcomp *zcomp_create(const char *comp, int max_strm);
+void zcomp_destroy(struct zcomp *comp);
+
+int zcomp_set_max_streams(struct zcomp *comp, int max_strm);
+
+struct zcomp_strm *zcomp_strm_find(struct zcomp *comp);
+void zcomp_strm_release(struct zcomp *comp, struct zcomp_strm *zstrm);
+
+int zcomp_compress(struct zcomp *comp, struct zcomp_strm *zstrm,
+		const unsigned char *src, size_t *dst_len);
+int zcomp_decompress(struct zcomp *comp, const unsigned char *src,
+		size_t src_len, unsigned char *dst);
+
+ssize_t zcomp_strm_stats(struct zcomp *comp, char *buf, size_t len);
+
+#endif
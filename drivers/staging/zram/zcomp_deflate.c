@@ -0,0 +1,69 @@
+/*
+ * Deflate compression backend for zram, using the crypto API
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#include <linux/crypto.h>
+#include <linux/err.h>
+#include <linux/kernel.h>
+
+#include "zcomp_deflate.h"
+
+/*
+ * A crypto_comp transform carries the zlib stream state, so it cannot be
+ * shared: every compression stream and every per-CPU decompression
+ * context owns one. Allocating it may sleep on GFP_KERNEL memory and
+ * vmalloc the zlib workspace, hence prealloc_strm below.
+ */
+static void *zcomp_deflate_create(void)
+{
+	struct crypto_comp *tfm;
+
+	tfm = crypto_alloc_comp("deflate", 0, 0);
+	if (IS_ERR(tfm))
+		return NULL;
+
+	return tfm;
+}
+
+static void zcomp_deflate_destroy(void *private)
+{
+	crypto_free_comp(private);
+}
+
+static int zcomp_deflate_compress(const unsigned char *src,
+		unsigned char *dst, size_t *dst_len, void *private)
+{
+	int ret;
+	unsigned int dlen = 2 * PAGE_SIZE;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &dlen);
+	*dst_len = dlen;
+
+	return ret;
+}
+
+static int zcomp_deflate_decompress(const unsigned char *src,
+		size_t src_len, unsigned char *dst, void *private)
+{
+	unsigned int dlen = PAGE_SIZE;
+
+	return crypto_comp_decompress(private, src, src_len, dst, &dlen);
+}
+
+struct zcomp_backend zcomp_deflate = {
+	.compress = zcomp_deflate_compress,
+	.decompress = zcomp_deflate_decompress,
+	.create = zcomp_deflate_create,
+	.destroy = zcomp_deflate_destroy,
+	.decompress_ctx = 1,
+	.prealloc_strm = 1,
+	.name = "deflate",
+};
@@ -0,0 +1,157 @@
+/*
+ * Same page deduplication for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Every stored object is described by a zram_entry. With deduplication
+ * enabled, entries are also hashed on (checksum of the uncompressed page,
+ * compressed length). A write whose page matches an existing entry takes
+ * a reference on it instead of storing a second copy. Since compression
+ * is deterministic, equal compressed data means equal pages, so the final
+ * check compares the compressed bytes.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* One hash bucket per this many disk pages */
+#define ZRAM_DEDUP_PAGES_PER_BUCKET	8
+
+u32 zram_dedup_checksum(unsigned char *mem)
+{
+	return jhash2((u32 *)mem, PAGE_SIZE / sizeof(u32), 0);
+}
+
+static struct zram_hash *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->hash[checksum & (zram->hash_size - 1)];
+}
+
+/*
+ * Looks for an entry holding the same data as @mem. On success a
+ * reference is taken on the returned entry.
+ */
+struct zram_entry *zram_dedup_find(struct zram *zram, unsigned char *mem,
+				size_t len, u32 checksum)
+{
+	struct zram_hash *hash;
+	struct zram_entry *entry;
+	struct hlist_node *pos;
+	unsigned char *cmem;
+	int match;
+
+	if (!zram->hash)
+		return NULL;
+
+	hash = zram_dedup_bucket(zram, checksum);
+
+	spin_lock(&hash->lock);
+	hlist_for_each_entry(entry, pos, &hash->head, node) {
+		if (entry->checksum != checksum || entry->len != len)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+		match = !memcmp(cmem, mem, len);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+
+		if (match) {
+			entry->refcount++;
+			spin_unlock(&hash->lock);
+			return entry;
+		}
+	}
+	spin_unlock(&hash->lock);
+
+	return NULL;
+}
+
+void zram_dedup_insert(struct zram *zram, struct zram_entry *entry,
+			u32 checksum)
+{
+	struct zram_hash *hash;
+
+	if (!zram->hash)
+		return;
+
+	entry->checksum = checksum;
+	hash = zram_dedup_bucket(zram, checksum);
+
+	spin_lock(&hash->lock);
+	hlist_add_head(&entry->node, &hash->head);
+	spin_unlock(&hash->lock);
+}
+
+/*
+ * Drops a reference and returns the number left. The entry is unhashed
+ * when the last one goes; freeing it is up to the caller.
+ */
+unsigned long zram_dedup_put(struct zram *zram, struct zram_entry *entry)
+{
+	struct zram_hash *hash;
+	unsigned long refcount;
+
+	if (!zram->hash) {
+		BUG_ON(entry->refcount != 1);
+		entry->refcount = 0;
+		return 0;
+	}
+
+	hash = zram_dedup_bucket(zram, entry->checksum);
+
+	spin_lock(&hash->lock);
+	refcount = --entry->refcount;
+	if (!refcount)
+		hlist_del(&entry->node);
+	spin_unlock(&hash->lock);
+
+	return refcount;
+}
+
+int zram_dedup_init(struct zram *zram, size_t num_pages)
+{
+	size_t i;
+
+	zram->hash = NULL;
+	zram->hash_size = 0;
+
+	if (!zram->use_dedup)
+		return 0;
+
+	zram->hash_size = rounddown_pow_of_two(max_t(size_t, 1,
+				num_pages / ZRAM_DEDUP_PAGES_PER_BUCKET));
+	zram->hash = vzalloc(zram->hash_size * sizeof(struct zram_hash));
+	if (!zram->hash) {
+		pr_err("Error allocating zram entry hash\n");
+		zram->hash_size = 0;
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < zram->hash_size; i++) {
+		spin_lock_init(&zram->hash[i].lock);
+		INIT_HLIST_HEAD(&zram->hash[i].head);
+	}
+
+	return 0;
+}
+
+void zram_dedup_fini(struct zram *zram)
+{
+	vfree(zram->hash);
+	zram->hash = NULL;
+	zram->hash_size = 0;
+}
@@ -25,11 +25,12 @@
 #include <linux/bitops.h>
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
+#include <linux/cpumask.h>
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -37,6 +38,7 @@
 
 /* Globals */
 static int zram_major;
+static struct kmem_cache *zram_entry_cache;
 struct zram *devices;
 
 /* Module params (documentation at end) */
@@ -71,6 +73,38 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	zram_stat64_add(zram, v, 1);
 }
 
+static u64 zram_algo_stat_begin(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static void zram_algo_stat_compr(struct zram *zram, u64 start, size_t clen)
+{
+	struct zram_algo_stats *astats = &zram->algo_stats[zram->comp->id];
+	u64 delta = ktime_to_ns(ktime_get()) - start;
+
+	spin_lock(&zram->stat64_lock);
+	astats->num_compr++;
+	astats->compr_ns += delta;
+	if (clen > max_zpage_size) {
+		astats->pages_expand++;
+		astats->compr_size += PAGE_SIZE;
+	} else
+		astats->compr_size += clen;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_algo_stat_decompr(struct zram *zram, u64 start)
+{
+	struct zram_algo_stats *astats = &zram->algo_stats[zram->comp->id];
+	u64 delta = ktime_to_ns(ktime_get()) - start;
+
+	spin_lock(&zram->stat64_lock);
+	astats->num_decompr++;
+	astats->decompr_ns += delta;
+	spin_unlock(&zram->stat64_lock);
+}
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -89,6 +123,29 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+static u32 zram_uptime(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return ts.tv_sec;
+}
+
+/*
+ * Records an access to a page, which makes it non-idle. Caller holds
+ * tb_lock; readers may race here but all of them store the same values.
+ */
+static void zram_touch(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_uptime();
+	if (zram_test_flag(zram, index, ZRAM_IDLE))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+}
+#else
+static inline void zram_touch(struct zram *zram, u32 index) { }
+#endif
+
 static int page_zero_filled(void *ptr)
 {
 	unsigned int pos;
@@ -133,15 +190,63 @@ static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 	zram->disksize &= PAGE_MASK;
 }
 
+static struct zram_entry *zram_entry_alloc(struct zram *zram, size_t len)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (!entry)
+		return NULL;
+
+	entry->handle = zs_malloc(zram->mem_pool, len);
+	if (!entry->handle) {
+		kmem_cache_free(zram_entry_cache, entry);
+		return NULL;
+	}
+
+	INIT_HLIST_NODE(&entry->node);
+	entry->refcount = 1;
+	entry->checksum = 0;
+	entry->len = len;
+
+	return entry;
+}
+
+/* Drops a reference to @entry, freeing the object with the last one */
+static void zram_entry_put(struct zram *zram, struct zram_entry *entry)
+{
+	u16 len = entry->len;
+
+	if (zram_dedup_put(zram, entry)) {
+		/* Only this page's share of the object goes away */
+		zram_stat64_sub(zram, &zram->stats.dup_data_size, len);
+		return;
+	}
+
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+}
+
+/* Caller must hold tb_lock for writing */
 static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
-	void *obj;
-
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	struct zram_entry *entry = zram->table[index].entry;
+
+	zram_clear_flag(zram, index, ZRAM_IDLE);
+	/* Tells a writeback in progress that the page went away */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_wb_free_block(zram, zram->table[index].blk_idx);
+		zram->table[index].blk_idx = 0;
+		zram_stat_dec(&zram->stats.pages_stored);
+		zram_stat64_sub(zram, &zram->stats.bd_count, 1);
+		return;
+	}
 
-	if (unlikely(!page)) {
+	if (unlikely(!entry)) {
 		/*
 		 * No memory is allocated for zero filled pages.
 		 * Simply clear zero page flag.
@@ -153,28 +258,19 @@ static void zram_free_page(struct zram *zram, size_t index)
 		return;
 	}
 
+	clen = entry->len;
+	zram_entry_put(zram, entry);
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
 		zram_stat_dec(&zram->stats.pages_expand);
-		goto out;
-	}
-
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
-
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
+	} else if (clen <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
-out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+	zram->table[index].entry = NULL;
 }
 
 static void handle_zero_page(struct bio_vec *bvec)
@@ -193,13 +289,14 @@ static void handle_uncompressed_page(struct zram *zram, struct bio_vec *bvec,
 				     u32 index, int offset)
 {
 	struct page *page = bvec->bv_page;
+	unsigned long handle = zram->table[index].entry->handle;
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem + bvec->bv_offset, cmem + offset, bvec->bv_len);
-	kunmap_atomic(cmem, KM_USER1);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -210,24 +307,106 @@ static inline int is_partial_io(struct bio_vec *bvec)
 	return bvec->bv_len != PAGE_SIZE;
 }
 
+/* Reads a written back page. May sleep: tb_lock must not be held. */
+static int zram_read_from_bdev(struct zram *zram, u32 index,
+			       unsigned long blk_idx, struct page *page)
+{
+	int ret;
+
+	ret = zram_wb_read(zram, blk_idx, page);
+	if (unlikely(ret)) {
+		pr_err("Backing device read failed! err=%d, page=%u\n",
+			ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return ret;
+	}
+
+	zram_stat64_inc(zram, &zram->stats.bd_reads);
+	return 0;
+}
+
+static int zram_bvec_read_wb(struct zram *zram, struct bio_vec *bvec,
+			     u32 index, int offset, unsigned long blk_idx)
+{
+	int ret;
+	struct page *page = bvec->bv_page, *tmp;
+	unsigned char *user_mem, *src;
+
+	if (!is_partial_io(bvec)) {
+		ret = zram_read_from_bdev(zram, index, blk_idx, page);
+		goto out;
+	}
+
+	tmp = alloc_page(GFP_NOIO);
+	if (!tmp) {
+		pr_info("Error allocating temp memory!\n");
+		return -ENOMEM;
+	}
+
+	ret = zram_read_from_bdev(zram, index, blk_idx, tmp);
+	if (!ret) {
+		user_mem = kmap_atomic(page, KM_USER0);
+		src = kmap_atomic(tmp, KM_USER1);
+		memcpy(user_mem + bvec->bv_offset, src + offset,
+		       bvec->bv_len);
+		kunmap_atomic(src, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
+	}
+	__free_page(tmp);
+
+out:
+	if (!ret)
+		flush_dcache_page(page);
+	return ret;
+}
+
 static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 			  u32 index, int offset, struct bio *bio)
 {
 	int ret;
-	size_t clen;
+	u64 start;
 	struct page *page;
-	struct zobj_header *zheader;
+	struct zram_entry *entry;
 	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
 
+	if (is_partial_io(bvec)) {
+		/* Use  a temporary buffer to decompress the page */
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
+		if (!uncmem) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+	}
+
+	read_lock(&zram->tb_lock);
+	zram_touch(zram, index);
+
 	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		read_unlock(&zram->tb_lock);
+		kfree(uncmem);
 		handle_zero_page(bvec);
 		return 0;
 	}
 
+	/*
+	 * The block cannot be reused once the lock is dropped: it is only
+	 * freed with the slot, which is not done while it is being read.
+	 */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		unsigned long blk_idx = zram->table[index].blk_idx;
+
+		read_unlock(&zram->tb_lock);
+		kfree(uncmem);
+		return zram_bvec_read_wb(zram, bvec, index, offset, blk_idx);
+	}
+
 	/* Requested page is not present in compressed area */
-	if (unlikely(!zram->table[index].page)) {
+	entry = zram->table[index].entry;
+	if (unlikely(!entry)) {
+		read_unlock(&zram->tb_lock);
+		kfree(uncmem);
 		pr_debug("Read before write: sector=%lu, size=%u",
 			 (ulong)(bio->bi_sector), bio->bi_size);
 		handle_zero_page(bvec);
@@ -237,29 +416,23 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		handle_uncompressed_page(zram, bvec, index, offset);
+		read_unlock(&zram->tb_lock);
+		kfree(uncmem);
 		return 0;
 	}
 
-	if (is_partial_io(bvec)) {
-		/* Use  a temporary buffer to decompress the page */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
-		if (!uncmem) {
-			pr_info("Error allocating temp memory!\n");
-			return -ENOMEM;
-		}
-	}
-
 	user_mem = kmap_atomic(page, KM_USER0);
 	if (!is_partial_io(bvec))
 		uncmem = user_mem;
-	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+
+	start = zram_algo_stat_begin();
+	ret = zcomp_decompress(zram->comp, cmem, entry->len, uncmem);
+	zram_algo_stat_decompr(zram, start);
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    uncmem, &clen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	read_unlock(&zram->tb_lock);
 
 	if (is_partial_io(bvec)) {
 		memcpy(user_mem + bvec->bv_offset, uncmem + offset,
@@ -267,11 +440,10 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 		kfree(uncmem);
 	}
 
-	kunmap_atomic(cmem, KM_USER1);
 	kunmap_atomic(user_mem, KM_USER0);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -285,33 +457,55 @@ static int zram_bvec_read(struct zram *zram, struct bio_vec *bvec,
 static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 {
 	int ret;
-	size_t clen = PAGE_SIZE;
-	struct zobj_header *zheader;
+	u64 start;
 	unsigned char *cmem;
+	struct zram_entry *entry;
 
-	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
-	    !zram->table[index].page) {
+	read_lock(&zram->tb_lock);
+
+	entry = zram->table[index].entry;
+	if (zram_test_flag(zram, index, ZRAM_ZERO) || !entry) {
+		read_unlock(&zram->tb_lock);
 		memset(mem, 0, PAGE_SIZE);
 		return 0;
 	}
 
-	cmem = kmap_atomic(zram->table[index].page, KM_USER0) +
-		zram->table[index].offset;
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		unsigned long blk_idx = zram->table[index].blk_idx;
+		struct page *page;
+
+		read_unlock(&zram->tb_lock);
+
+		page = alloc_page(GFP_NOIO);
+		if (!page) {
+			pr_info("Error allocating temp memory!\n");
+			return -ENOMEM;
+		}
+		ret = zram_read_from_bdev(zram, index, blk_idx, page);
+		if (!ret)
+			memcpy(mem, page_address(page), PAGE_SIZE);
+		__free_page(page);
+		return ret;
+	}
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
 
 	/* Page is stored uncompressed since it's incompressible */
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		memcpy(mem, cmem, PAGE_SIZE);
-		kunmap_atomic(cmem, KM_USER0);
+		zs_unmap_object(zram->mem_pool, entry->handle);
+		read_unlock(&zram->tb_lock);
 		return 0;
 	}
 
-	ret = lzo1x_decompress_safe(cmem + sizeof(*zheader),
-				    xv_get_object_size(cmem) - sizeof(*zheader),
-				    mem, &clen);
-	kunmap_atomic(cmem, KM_USER0);
+	start = zram_algo_stat_begin();
+	ret = zcomp_decompress(zram->comp, cmem, entry->len, mem);
+	zram_algo_stat_decompr(zram, start);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+	read_unlock(&zram->tb_lock);
 
 	/* Should NEVER happen. Return bio error if it does. */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
 		zram_stat64_inc(zram, &zram->stats.failed_reads);
 		return ret;
@@ -320,44 +514,48 @@ static int zram_read_before_write(struct zram *zram, char *mem, u32 index)
 	return 0;
 }
 
+/*
+ * Compression runs on a private stream without any device-wide lock;
+ * tb_lock is only taken to swap the new object into the table, so
+ * writers to different indices proceed in parallel.
+ */
 static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 			   int offset)
 {
-	int ret;
-	u32 store_offset;
+	int ret = 0;
+	u64 start;
 	size_t clen;
-	struct zobj_header *zheader;
-	struct page *page, *page_store;
-	unsigned char *user_mem, *cmem, *src, *uncmem = NULL;
+	u32 checksum = 0;
+	struct zram_entry *entry;
+	struct zcomp_strm *zstrm = NULL;
+	struct page *page;
+	unsigned char *user_mem, *cmem, *uncmem = NULL;
 
 	page = bvec->bv_page;
-	src = zram->compress_buffer;
 
 	if (is_partial_io(bvec)) {
 		/*
 		 * This is a partial IO. We need to read the full page
 		 * before to write the changes.
 		 */
-		uncmem = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		uncmem = kmalloc(PAGE_SIZE, GFP_NOIO);
 		if (!uncmem) {
 			pr_info("Error allocating temp memory!\n");
 			ret = -ENOMEM;
 			goto out;
 		}
 		ret = zram_read_before_write(zram, uncmem, index);
-		if (ret) {
-			kfree(uncmem);
+		if (ret)
 			goto out;
-		}
 	}
 
-	/*
-	 * System overwrites unused sectors. Free memory associated
-	 * with this sector now.
-	 */
-	if (zram->table[index].page ||
-	    zram_test_flag(zram, index, ZRAM_ZERO))
-		zram_free_page(zram, index);
+	/* May sleep until another writer releases its stream */
+	zstrm = zcomp_strm_find(zram->comp);
+	if (unlikely(!zstrm)) {
+		pr_info("Error allocating compression stream\n");
+		ret = -ENOMEM;
+		goto out;
+	}
 
 	user_mem = kmap_atomic(page, KM_USER0);
 
@@ -369,88 +567,99 @@ static int zram_bvec_write(struct zram *zram, struct bio_vec *bvec, u32 index,
 
 	if (page_zero_filled(uncmem)) {
 		kunmap_atomic(user_mem, KM_USER0);
-		if (is_partial_io(bvec))
-			kfree(uncmem);
+		/*
+		 * System overwrites unused sectors. Free memory associated
+		 * with this sector now.
+		 */
+		write_lock(&zram->tb_lock);
+		zram_free_page(zram, index);
 		zram_stat_inc(&zram->stats.pages_zero);
 		zram_set_flag(zram, index, ZRAM_ZERO);
-		ret = 0;
+		write_unlock(&zram->tb_lock);
 		goto out;
 	}
 
-	ret = lzo1x_1_compress(uncmem, PAGE_SIZE, src, &clen,
-			       zram->compress_workmem);
+	start = zram_algo_stat_begin();
+	ret = zcomp_compress(zram->comp, zstrm, uncmem, &clen);
+	if (likely(!ret)) {
+		zram_algo_stat_compr(zram, start, clen);
+
+		/*
+		 * Page is incompressible. Store it as-is (uncompressed)
+		 * since we do not want to return too many disk write
+		 * errors which has side effect of hanging the system.
+		 * Staging it in the stream buffer keeps a single store
+		 * path below, which runs with the page unmapped.
+		 */
+		if (unlikely(clen > max_zpage_size)) {
+			clen = PAGE_SIZE;
+			memcpy(zstrm->buffer, uncmem, PAGE_SIZE);
+		}
+
+		if (zram->hash)
+			checksum = zram_dedup_checksum(uncmem);
+	}
 
 	kunmap_atomic(user_mem, KM_USER0);
-	if (is_partial_io(bvec))
-			kfree(uncmem);
+	if (!is_partial_io(bvec))
+		uncmem = NULL;
 
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret)) {
 		pr_err("Compression failed! err=%d\n", ret);
 		goto out;
 	}
 
-	/*
-	 * Page is incompressible. Store it as-is (uncompressed)
-	 * since we do not want to return too many disk write
-	 * errors which has side effect of hanging the system.
-	 */
-	if (unlikely(clen > max_zpage_size)) {
-		clen = PAGE_SIZE;
-		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-		if (unlikely(!page_store)) {
-			pr_info("Error allocating memory for "
-				"incompressible page: %u\n", index);
+	entry = zram_dedup_find(zram, zstrm->buffer, clen, checksum);
+	if (entry) {
+		zram_stat64_inc(zram, &zram->stats.dedup_hits);
+		zram_stat64_add(zram, &zram->stats.dup_data_size, clen);
+	} else {
+		entry = zram_entry_alloc(zram, clen);
+		if (!entry) {
+			pr_info("Error allocating memory for compressed "
+				"page: %u, size=%zu\n", index, clen);
 			ret = -ENOMEM;
 			goto out;
 		}
 
-		store_offset = 0;
-		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_inc(&zram->stats.pages_expand);
-		zram->table[index].page = page_store;
-		src = kmap_atomic(page, KM_USER0);
-		goto memstore;
-	}
+		cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_WO);
+		memcpy(cmem, zstrm->buffer, clen);
+		zs_unmap_object(zram->mem_pool, entry->handle);
 
-	if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-		      &zram->table[index].page, &store_offset,
-		      GFP_NOIO | __GFP_HIGHMEM)) {
-		pr_info("Error allocating memory for compressed "
-			"page: %u, size=%zu\n", index, clen);
-		ret = -ENOMEM;
-		goto out;
+		zram_dedup_insert(zram, entry, checksum);
 	}
 
-memstore:
-	zram->table[index].offset = store_offset;
-
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-		zram->table[index].offset;
-
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+	zcomp_strm_release(zram->comp, zstrm);
+	zstrm = NULL;
 
-	memcpy(cmem, src, clen);
+	/*
+	 * Free memory associated with this sector now, then publish the
+	 * new object. Both happen under tb_lock so readers see either
+	 * the old or the new contents, never a half-updated entry.
+	 */
+	write_lock(&zram->tb_lock);
+	zram_free_page(zram, index);
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	zram->table[index].entry = entry;
+	zram_touch(zram, index);
 
 	/* Update stats */
-	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+	if (unlikely(clen == PAGE_SIZE)) {
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	}
 	zram_stat_inc(&zram->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		zram_stat_inc(&zram->stats.good_compress);
+	write_unlock(&zram->tb_lock);
 
-	return 0;
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
 
 out:
+	if (zstrm)
+		zcomp_strm_release(zram->comp, zstrm);
+	if (is_partial_io(bvec))
+		kfree(uncmem);
 	if (ret)
 		zram_stat64_inc(zram, &zram->stats.failed_writes);
 	return ret;
@@ -461,15 +670,10 @@ static int zram_bvec_rw(struct zram *zram, struct bio_vec *bvec, u32 index,
 {
 	int ret;
 
-	if (rw == READ) {
-		down_read(&zram->lock);
+	if (rw == READ)
 		ret = zram_bvec_read(zram, bvec, index, offset, bio);
-		up_read(&zram->lock);
-	} else {
-		down_write(&zram->lock);
+	else
 		ret = zram_bvec_write(zram, bvec, index, offset);
-		up_write(&zram->lock);
-	}
 
 	return ret;
 }
@@ -576,6 +780,143 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Marks stored pages idle which were not accessed for the last @min_age
+ * seconds, all of them if @min_age is 0. Caller holds init_lock.
+ */
+void zram_mark_idle(struct zram *zram, u32 min_age)
+{
+	u32 index, num_pages = zram->disksize >> PAGE_SHIFT;
+	u32 now = zram_uptime();
+
+	for (index = 0; index < num_pages; index++) {
+		write_lock(&zram->tb_lock);
+		if (zram->table[index].entry &&
+		    !zram_test_flag(zram, index, ZRAM_WB) &&
+		    now - zram->table[index].ac_time >= min_age)
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->tb_lock);
+	}
+}
+
+static int zram_wb_pick(struct zram *zram, u32 index, enum zram_wb_mode mode)
+{
+	int ret = 0;
+
+	write_lock(&zram->tb_lock);
+	if (!zram->table[index].entry || zram_test_flag(zram, index, ZRAM_WB))
+		goto out;
+
+	if (mode == ZRAM_WB_HUGE &&
+	    !zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		goto out;
+
+	if (mode == ZRAM_WB_IDLE && !zram_test_flag(zram, index, ZRAM_IDLE))
+		goto out;
+
+	zram_set_flag(zram, index, ZRAM_UNDER_WB);
+	ret = 1;
+out:
+	write_unlock(&zram->tb_lock);
+	return ret;
+}
+
+/*
+ * Replaces the in-memory copy of page @index by block @blk_idx, unless
+ * writing the block failed or the page was freed in the meantime.
+ */
+static void zram_wb_commit(struct zram *zram, u32 index,
+			   unsigned long blk_idx, int err)
+{
+	write_lock(&zram->tb_lock);
+	if (err || !zram_test_flag(zram, index, ZRAM_UNDER_WB)) {
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		write_unlock(&zram->tb_lock);
+		zram_wb_free_block(zram, blk_idx);
+		return;
+	}
+
+	zram_free_page(zram, index);
+	zram_set_flag(zram, index, ZRAM_WB);
+	zram->table[index].blk_idx = blk_idx;
+	zram_stat_inc(&zram->stats.pages_stored);
+	write_unlock(&zram->tb_lock);
+
+	zram_stat64_inc(zram, &zram->stats.bd_count);
+	zram_stat64_inc(zram, &zram->stats.bd_writes);
+}
+
+/*
+ * Moves the pages selected by @mode to the backing device. Pages are
+ * copied out and written ZRAM_WB_BATCH at a time; the table is only
+ * updated once a batch has completed. Caller holds init_lock.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	struct page *pages[ZRAM_WB_BATCH];
+	unsigned long blk_idx[ZRAM_WB_BATCH];
+	u32 slots[ZRAM_WB_BATCH];
+	u32 index = 0, num_pages = zram->disksize >> PAGE_SHIFT;
+	int i, nr, nr_pages, err, ret = 0;
+
+	if (!zram->bdev)
+		return -ENODEV;
+
+	for (nr_pages = 0; nr_pages < ZRAM_WB_BATCH; nr_pages++) {
+		pages[nr_pages] = alloc_page(GFP_KERNEL);
+		if (!pages[nr_pages])
+			break;
+	}
+	if (!nr_pages)
+		return -ENOMEM;
+
+	while (index < num_pages && !ret) {
+		for (nr = 0; index < num_pages && nr < nr_pages; index++) {
+			if (!zram_wb_pick(zram, index, mode))
+				continue;
+
+			blk_idx[nr] = zram_wb_alloc_block(zram);
+			if (!blk_idx[nr]) {
+				write_lock(&zram->tb_lock);
+				zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+				write_unlock(&zram->tb_lock);
+				ret = -ENOSPC;
+				break;
+			}
+
+			err = zram_read_before_write(zram,
+					page_address(pages[nr]), index);
+			if (err) {
+				zram_wb_commit(zram, index, blk_idx[nr], err);
+				continue;
+			}
+
+			slots[nr++] = index;
+		}
+
+		if (!nr)
+			break;
+
+		err = zram_wb_write(zram, pages, blk_idx, nr);
+		if (err) {
+			pr_err("Backing device write failed! err=%d\n", err);
+			ret = err;
+		}
+
+		for (i = 0; i < nr; i++)
+			zram_wb_commit(zram, slots[i], blk_idx[i], err);
+
+		cond_resched();
+	}
+
+	while (nr_pages--)
+		__free_page(pages[nr_pages]);
+
+	return ret;
+}
+#endif
+
 void zram_reset_device(struct zram *zram)
 {
 	size_t index;
@@ -584,33 +925,32 @@ void zram_reset_device(struct zram *zram)
 	zram->init_done = 0;
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
-
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+	if (zram->comp)
+		zcomp_destroy(zram->comp);
+	zram->comp = NULL;
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+	/*
+	 * Free all pages that are still in this zram device; there is no
+	 * table if initialization failed before allocating it.
+	 */
+	for (index = 0; zram->table &&
+	     index < zram->disksize >> PAGE_SHIFT; index++) {
+		struct zram_entry *entry = zram->table[index].entry;
 
-		if (!page)
+		if (!entry || zram_test_flag(zram, index, ZRAM_WB))
 			continue;
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		zram_entry_put(zram, entry);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_dedup_fini(zram);
+	zram_wb_reset(zram);
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -634,16 +974,12 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zcomp_create(zram->compressor, zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error initializing %s compressor!\n",
+			zram->compressor);
+		/* No table yet, see below */
+		zram->disksize = 0;
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -663,13 +999,18 @@ int zram_init_device(struct zram *zram)
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name,
+					GFP_NOIO | __GFP_HIGHMEM);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	ret = zram_dedup_init(zram, num_pages);
+	if (ret)
+		goto fail;
+
 	zram->init_done = 1;
 	mutex_unlock(&zram->init_lock);
 
@@ -689,7 +1030,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->tb_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->tb_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -702,9 +1045,14 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	init_rwsem(&zram->lock);
+	rwlock_init(&zram->tb_lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spin_lock_init(&zram->bitmap_lock);
+#endif
+	zram->max_comp_streams = num_online_cpus();
+	zram->compressor = default_compressor;
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -787,11 +1135,17 @@ static int __init zram_init(void)
 		goto out;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
 	zram_major = register_blkdev(0, "zram");
 	if (zram_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto free_cache;
 	}
 
 	if (!num_devices) {
@@ -821,6 +1175,8 @@ free_devices:
 	kfree(devices);
 unregister:
 	unregister_blkdev(zram_major, "zram");
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 out:
 	return ret;
 }
@@ -841,6 +1197,7 @@ static void __exit zram_exit(void)
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -15,10 +15,14 @@
 #ifndef _ZRAM_DRV_H_
 #define _ZRAM_DRV_H_
 
+#include <linux/list.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
+#include "zram_dedup.h"
+#include "zram_writeback.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -26,20 +30,11 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
+/* Compression backend used unless another is selected through sysfs */
+static const char * const default_compressor = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -51,8 +46,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE (PAGE_SIZE)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -74,17 +69,47 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page lives on the backing device, table entry holds its block */
+	ZRAM_WB,
+
+	/* Page is being written back, cleared if it is freed meanwhile */
+	ZRAM_UNDER_WB,
+
+	/* Page was not accessed since it was last marked idle */
+	ZRAM_IDLE,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * Describes a stored object. Several disk pages may share one entry
+ * when deduplication is enabled.
+ */
+struct zram_entry {
+	struct hlist_node node;		/* entry in zram->hash bucket */
+	unsigned long handle;
+	unsigned long refcount;		/* protected by bucket lock */
+	u32 checksum;			/* of the uncompressed page */
+	u16 len;			/* compressed size of the object */
+};
+
+struct zram_hash {
+	spinlock_t lock;
+	struct hlist_head head;
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct zram_entry *entry;
+		unsigned long blk_idx;	/* if ZRAM_WB */
+	};
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds of uptime */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -99,16 +124,32 @@ struct zram_stats {
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u64 dedup_hits;		/* no. of writes which found a duplicate */
+	u64 dup_data_size;	/* compressed bytes not stored thanks to that */
+	u64 bd_count;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* no. of pages read from it */
+	u64 bd_writes;		/* no. of pages written to it */
+};
+
+/*
+ * Per compression algorithm stats. Unlike zram_stats these survive a
+ * device reset so that algorithms can be compared one after another.
+ */
+struct zram_algo_stats {
+	u64 num_compr;		/* no. of pages compressed */
+	u64 compr_size;		/* total size of their compressed output */
+	u64 compr_ns;		/* time spent compressing */
+	u64 num_decompr;	/* no. of pages decompressed */
+	u64 decompr_ns;		/* time spent decompressing */
+	u64 pages_expand;	/* no. of pages which did not compress */
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zcomp *comp;
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct rw_semaphore lock; /* protect compression buffers and table
-				   * against concurrent read and writes */
+	rwlock_t tb_lock;	/* protect table entries and 32-bit stats */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -119,8 +160,27 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	/* Upper limit on concurrent compression streams */
+	int max_comp_streams;
+	/* Compression backend, can only be changed before init */
+	const char *compressor;
+
+	/* Share identical pages, can only be changed before init */
+	int use_dedup;
+	struct zram_hash *hash;
+	size_t hash_size;
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* Backing device, can only be changed before init */
+	char *backing_dev;		/* its path, NULL if none */
+	struct block_device *bdev;
+	unsigned long *bitmap;		/* blocks in use */
+	unsigned long nr_blocks;	/* size in pages */
+	spinlock_t bitmap_lock;
+#endif
 
 	struct zram_stats stats;
+	struct zram_algo_stats algo_stats[__NR_ZCOMP_BACKENDS];
 };
 
 extern struct zram *devices;
@@ -131,5 +191,9 @@ extern struct attribute_group zram_disk_attr_group;
 
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern void zram_mark_idle(struct zram *zram, u32 min_age);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode);
+#endif
 
 #endif
@@ -0,0 +1,247 @@
+/*
+ * Backing device support for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Pages written back are stored uncompressed, one per PAGE_SIZE block
+ * of the backing device. A bitmap tracks the blocks in use; block 0 is
+ * never handed out so that it can stand for "no block".
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "zram_drv.h"
+
+#define ZRAM_WB_MODE	(FMODE_READ | FMODE_WRITE | FMODE_EXCL)
+
+int zram_wb_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long *bitmap;
+	unsigned long nr_blocks;
+	char *name;
+	int ret;
+
+	name = kstrdup(path, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	strim(name);
+
+	bdev = blkdev_get_by_path(name, ZRAM_WB_MODE, zram);
+	if (IS_ERR(bdev)) {
+		ret = PTR_ERR(bdev);
+		goto out_free;
+	}
+
+	if (bdev->bd_disk == zram->disk) {
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_blocks < 2) {
+		ret = -ENOSPC;
+		goto out_put;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	set_bit(0, bitmap);
+
+	zram_wb_reset(zram);
+
+	zram->backing_dev = name;
+	zram->bdev = bdev;
+	zram->bitmap = bitmap;
+	zram->nr_blocks = nr_blocks;
+
+	pr_info("%s: using %s for writeback, %lu pages\n",
+		zram->disk->disk_name, name, nr_blocks - 1);
+
+	return 0;
+
+out_put:
+	blkdev_put(bdev, ZRAM_WB_MODE);
+out_free:
+	kfree(name);
+	return ret;
+}
+
+/* Releases the backing device, if any. Caller holds init_lock. */
+void zram_wb_reset(struct zram *zram)
+{
+	if (!zram->bdev)
+		return;
+
+	blkdev_put(zram->bdev, ZRAM_WB_MODE);
+	vfree(zram->bitmap);
+	kfree(zram->backing_dev);
+
+	zram->bdev = NULL;
+	zram->bitmap = NULL;
+	zram->backing_dev = NULL;
+	zram->nr_blocks = 0;
+}
+
+/* Returns a free block of the backing device, 0 if there is none */
+unsigned long zram_wb_alloc_block(struct zram *zram)
+{
+	unsigned long blk_idx;
+
+	spin_lock(&zram->bitmap_lock);
+	blk_idx = find_next_zero_bit(zram->bitmap, zram->nr_blocks, 1);
+	if (blk_idx < zram->nr_blocks)
+		__set_bit(blk_idx, zram->bitmap);
+	else
+		blk_idx = 0;
+	spin_unlock(&zram->bitmap_lock);
+
+	return blk_idx;
+}
+
+/* May be called with tb_lock held */
+void zram_wb_free_block(struct zram *zram, unsigned long blk_idx)
+{
+	spin_lock(&zram->bitmap_lock);
+	WARN_ON(!__test_and_clear_bit(blk_idx, zram->bitmap));
+	spin_unlock(&zram->bitmap_lock);
+}
+
+static struct bio *zram_wb_bio(struct zram *zram, unsigned long blk_idx,
+			struct page *page, bio_end_io_t *end_io, void *private)
+{
+	struct bio *bio;
+
+	/* Backed by a mempool, cannot fail with __GFP_WAIT */
+	bio = bio_alloc(GFP_NOIO, 1);
+	bio->bi_bdev = zram->bdev;
+	bio->bi_sector = (sector_t)blk_idx << SECTORS_PER_PAGE_SHIFT;
+	bio_add_page(bio, page, PAGE_SIZE, 0);
+	bio->bi_end_io = end_io;
+	bio->bi_private = private;
+
+	return bio;
+}
+
+struct zram_wb_read_work {
+	struct work_struct work;
+	struct zram *zram;
+	unsigned long blk_idx;
+	struct page *page;
+	struct completion done;
+	int error;
+};
+
+static void zram_wb_end_read(struct bio *bio, int err)
+{
+	struct zram_wb_read_work *rw = bio->bi_private;
+
+	rw->error = err;
+	complete(&rw->done);
+	bio_put(bio);
+}
+
+static void zram_wb_read_fn(struct work_struct *work)
+{
+	struct zram_wb_read_work *rw;
+	struct bio *bio;
+
+	rw = container_of(work, struct zram_wb_read_work, work);
+	bio = zram_wb_bio(rw->zram, rw->blk_idx, rw->page,
+			zram_wb_end_read, rw);
+	submit_bio(READ, bio);
+	wait_for_completion(&rw->done);
+}
+
+/*
+ * Reads block @blk_idx into @page and waits for it. Reads come from our
+ * own make_request function, where bios we submit are only dispatched
+ * after it returns, so the bio is issued from a worker instead.
+ */
+int zram_wb_read(struct zram *zram, unsigned long blk_idx, struct page *page)
+{
+	struct zram_wb_read_work rw;
+
+	rw.zram = zram;
+	rw.blk_idx = blk_idx;
+	rw.page = page;
+	rw.error = 0;
+	init_completion(&rw.done);
+
+	INIT_WORK_ONSTACK(&rw.work, zram_wb_read_fn);
+	queue_work(system_unbound_wq, &rw.work);
+	flush_work(&rw.work);
+	destroy_work_on_stack(&rw.work);
+
+	return rw.error;
+}
+
+struct zram_wb_batch {
+	atomic_t pending;
+	struct completion done;
+	int error;
+};
+
+static void zram_wb_end_write(struct bio *bio, int err)
+{
+	struct zram_wb_batch *batch = bio->bi_private;
+
+	if (err)
+		batch->error = err;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/*
+ * Writes @nr pages to their blocks as one plugged batch and waits for
+ * all of them. Blocks are mostly allocated in ascending order, so the
+ * bios merge into a few large requests. Any error fails the batch.
+ */
+int zram_wb_write(struct zram *zram, struct page **pages,
+			unsigned long *blk_idx, int nr)
+{
+	struct zram_wb_batch batch;
+	struct blk_plug plug;
+	int i;
+
+	/* Hold one reference until all bios are submitted */
+	atomic_set(&batch.pending, 1);
+	init_completion(&batch.done);
+	batch.error = 0;
+
+	blk_start_plug(&plug);
+	for (i = 0; i < nr; i++) {
+		atomic_inc(&batch.pending);
+		submit_bio(WRITE, zram_wb_bio(zram, blk_idx[i], pages[i],
+					zram_wb_end_write, &batch));
+	}
+	blk_finish_plug(&plug);
+
+	if (!atomic_dec_and_test(&batch.pending))
+		wait_for_completion(&batch.done);
+
+	return batch.error;
+}
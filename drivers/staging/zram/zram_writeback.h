@@ -0,0 +1,53 @@
+/*
+ * Backing device support for zram
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZRAM_WRITEBACK_H_
+#define _ZRAM_WRITEBACK_H_
+
+#include <linux/errno.h>
+
+struct page;
+struct zram;
+
+/* Max no. of pages written back with a single batch of bios */
+#define ZRAM_WB_BATCH	32
+
+/* Slots selected by zram_writeback() */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,		/* stored uncompressed */
+	ZRAM_WB_IDLE,		/* marked idle through sysfs */
+};
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+int zram_wb_set_backing_dev(struct zram *zram, const char *path);
+void zram_wb_reset(struct zram *zram);
+
+unsigned long zram_wb_alloc_block(struct zram *zram);
+void zram_wb_free_block(struct zram *zram, unsigned long blk_idx);
+
+int zram_wb_read(struct zram *zram, unsigned long blk_idx, struct page *page);
+int zram_wb_write(struct zram *zram, struct page **pages,
+			unsigned long *blk_idx, int nr);
+#else
+static inline void zram_wb_reset(struct zram *zram) { }
+
+static inline void zram_wb_free_block(struct zram *zram,
+			unsigned long blk_idx) { }
+
+static inline int zram_wb_read(struct zram *zram, unsigned long blk_idx,
+			struct page *page)
+{
+	return -EIO;
+}
+#endif
+
+#endif
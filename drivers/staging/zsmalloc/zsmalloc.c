@@ -0,0 +1,744 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped by size into size classes spaced ZS_SIZE_CLASS_DELTA
+ * bytes apart. Each class carves its objects out of "zspages": chains of
+ * up to ZS_MAX_PAGES_PER_ZSPAGE order-0 pages, with the chain length
+ * chosen to minimize the space wasted at the end of the chain. Objects
+ * may therefore span two pages; such objects are copied through a per-CPU
+ * buffer when mapped.
+ *
+ * Users refer to objects by handle: a small slab-allocated record of the
+ * object's current location. This indirection lets zs_compact() migrate
+ * objects out of sparsely used zspages into fuller ones and return the
+ * emptied pages to the system.
+ *
+ * Locking: class->lock protects the zspage lists and free lists of a
+ * class. pool->migrate_lock is held for reading between zs_map_object()
+ * and zs_unmap_object(), and for writing while compaction moves an object
+ * and updates its handle. Lock order is class->lock, then migrate_lock,
+ * so callers must not allocate or free objects while holding a mapping.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+
+/*
+ * Object offsets are multiples of ZS_SIZE_CLASS_DELTA, so small
+ * allocations still fit in the first class.
+ */
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+#define ZS_SIZE_CLASS_DELTA	16
+#define ZS_SIZE_CLASSES		((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+
+/* Longest zspage chain; longer chains waste less but cost more per zspage */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/*
+ * zspage->handles[] holds the handle of each allocated object. Free
+ * objects hold the index of the next free object instead, tagged with
+ * OBJ_FREE (handles are slab pointers and never have that bit set).
+ */
+#define OBJ_FREE		1UL
+#define OBJ_FREE_SHIFT		1
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head partial;	/* zspages with free objects */
+	struct list_head full;		/* zspages without */
+	unsigned int size;
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+	unsigned int index;
+
+	/* stats, protected by lock */
+	unsigned long nr_zspages;
+	unsigned long objs_inuse;
+	unsigned long pages_compacted;
+};
+
+struct zspage {
+	struct list_head list;		/* entry in class->partial or full */
+	struct size_class *class;
+	unsigned int inuse;		/* no. of allocated objects */
+	unsigned int free_idx;		/* first free object */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long handles[0];	/* class->objs_per_zspage entries */
+};
+
+/* What a handle points to; updated only under class->lock + migrate_lock */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 idx;
+	u16 class_idx;
+};
+
+/* Per-CPU state of the current mapping */
+struct mapping_area {
+	char *buf;		/* copy of an object that spans two pages */
+	void *vaddr;		/* kmap_atomic()ed page otherwise */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+	rwlock_t migrate_lock;
+	struct kmem_cache *handle_cache;
+	struct mapping_area __percpu *map_area;
+	struct shrinker shrinker;
+	gfp_t flags;	/* allocation flags used when growing pool */
+	atomic_t pages_allocated;
+	char *name;
+};
+
+static int get_size_class_index(size_t size)
+{
+	int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the zspage chain length which leaves the smallest unusable tail
+ * for objects of the given size.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, max_usedpc = 0;
+	unsigned int max_usedpc_order = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 /
+				zspage_size;
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			max_usedpc_order = i;
+		}
+	}
+
+	return max_usedpc_order;
+}
+
+static void obj_location(struct size_class *class, unsigned int idx,
+			unsigned int *page_idx, unsigned int *offset)
+{
+	unsigned long off = (unsigned long)idx * class->size;
+
+	*page_idx = off >> PAGE_SHIFT;
+	*offset = off & ~PAGE_MASK;
+}
+
+/* Copy @len bytes starting at byte @off of a zspage from/to @buf */
+static void zspage_copy(struct zspage *zspage, unsigned long off,
+			char *buf, unsigned int len, int to_zspage)
+{
+	while (len) {
+		struct page *page = zspage->pages[off >> PAGE_SHIFT];
+		unsigned int poff = off & ~PAGE_MASK;
+		unsigned int n = min_t(unsigned int, len, PAGE_SIZE - poff);
+		char *vaddr = kmap_atomic(page, KM_USER1);
+
+		if (to_zspage)
+			memcpy(vaddr + poff, buf, n);
+		else
+			memcpy(buf, vaddr + poff, n);
+		kunmap_atomic(vaddr, KM_USER1);
+
+		off += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	struct size_class *class = zspage->class;
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+	kfree(zspage);
+}
+
+/* Called without class->lock: may sleep depending on pool->flags */
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class)
+{
+	struct zspage *zspage;
+	unsigned int i;
+
+	zspage = kzalloc(sizeof(*zspage) +
+			class->objs_per_zspage * sizeof(zspage->handles[0]),
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(pool->flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+	atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	/* Link all objects into the free list */
+	for (i = 0; i < class->objs_per_zspage; i++)
+		zspage->handles[i] = ((i + 1UL) << OBJ_FREE_SHIFT) | OBJ_FREE;
+	zspage->free_idx = 0;
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+/* Take a free object out of @zspage; caller holds class->lock */
+static unsigned int zspage_obj_alloc(struct zspage *zspage,
+				struct zs_handle *zh)
+{
+	struct size_class *class = zspage->class;
+	unsigned int idx = zspage->free_idx;
+
+	BUG_ON(idx >= class->objs_per_zspage);
+
+	zspage->free_idx = zspage->handles[idx] >> OBJ_FREE_SHIFT;
+	zspage->handles[idx] = (unsigned long)zh;
+	zspage->inuse++;
+	class->objs_inuse++;
+
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+
+	return idx;
+}
+
+/*
+ * Return object @idx to the free list of @zspage; caller holds
+ * class->lock. Returns 1 if the zspage became empty, in which case it
+ * has been unlinked and the caller must free it.
+ */
+static int zspage_obj_free(struct zspage *zspage, unsigned int idx)
+{
+	struct size_class *class = zspage->class;
+
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move_tail(&zspage->list, &class->partial);
+
+	zspage->handles[idx] = ((unsigned long)zspage->free_idx <<
+				OBJ_FREE_SHIFT) | OBJ_FREE;
+	zspage->free_idx = idx;
+	zspage->inuse--;
+	class->objs_inuse--;
+
+	if (zspage->inuse)
+		return 0;
+
+	list_del(&zspage->list);
+	class->nr_zspages--;
+	return 1;
+}
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0.
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size)
+{
+	struct zs_handle *zh;
+	struct size_class *class;
+	struct zspage *zspage, *new = NULL;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	zh = kmem_cache_alloc(pool->handle_cache,
+			pool->flags & ~__GFP_HIGHMEM);
+	if (!zh)
+		return 0;
+
+	class = &pool->size_class[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	while (list_empty(&class->partial)) {
+		if (new) {
+			list_add(&new->list, &class->partial);
+			class->nr_zspages++;
+			new = NULL;
+			break;
+		}
+
+		spin_unlock(&class->lock);
+		new = alloc_zspage(pool, class);
+		if (!new) {
+			kmem_cache_free(pool->handle_cache, zh);
+			return 0;
+		}
+		spin_lock(&class->lock);
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	zh->zspage = zspage;
+	zh->class_idx = class->index;
+	zh->idx = zspage_obj_alloc(zspage, zh);
+	spin_unlock(&class->lock);
+
+	/* Someone else refilled the class while we were allocating */
+	if (new)
+		free_zspage(pool, new);
+
+	return (unsigned long)zh;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class;
+	struct zspage *zspage;
+	int empty;
+
+	if (unlikely(!handle))
+		return;
+
+	/* The class of a handle never changes, its zspage may */
+	class = &pool->size_class[zh->class_idx];
+
+	spin_lock(&class->lock);
+	zspage = zh->zspage;
+	empty = zspage_obj_free(zspage, zh->idx);
+	spin_unlock(&class->lock);
+
+	if (empty)
+		free_zspage(pool, zspage);
+	kmem_cache_free(pool->handle_cache, zh);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get address of allocated object from handle.
+ * @pool: pool from which the object was allocated
+ * @handle: handle returned from zs_malloc
+ * @mm: mapping mode to use
+ *
+ * Before using an object allocated from zs_malloc, it must be mapped
+ * using this function. When done with the object, it must be unmapped
+ * using zs_unmap_object.
+ *
+ * Only one object can be mapped per cpu at a time. There is no protection
+ * against nested mappings. The object stays in place until unmapped, so
+ * this function must not be called with the handle's class lock held and
+ * no allocation or free may be done while an object is mapped.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct mapping_area *area;
+	struct size_class *class;
+	unsigned int page_idx, off;
+
+	BUG_ON(!handle);
+
+	/* Disables preemption until zs_unmap_object() */
+	read_lock(&pool->migrate_lock);
+
+	class = &pool->size_class[zh->class_idx];
+	obj_location(class, zh->idx, &page_idx, &off);
+
+	area = this_cpu_ptr(pool->map_area);
+	area->mm = mm;
+
+	if (off + class->size <= PAGE_SIZE) {
+		/* This object is contained entirely within a page */
+		area->vaddr = kmap_atomic(zh->zspage->pages[page_idx],
+					KM_USER1);
+		return area->vaddr + off;
+	}
+
+	/* This object spans two pages */
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zspage_copy(zh->zspage, (unsigned long)zh->idx * class->size,
+				area->buf, class->size, 0);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct mapping_area *area;
+	struct size_class *class;
+
+	BUG_ON(!handle);
+
+	area = this_cpu_ptr(pool->map_area);
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		class = &pool->size_class[zh->class_idx];
+		zspage_copy(zh->zspage, (unsigned long)zh->idx * class->size,
+				area->buf, class->size, 1);
+	}
+
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+/* Pages compaction could give back; caller holds class->lock */
+static unsigned long class_reclaimable_pages(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	obj_wasted = class->nr_zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return obj_wasted / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+/*
+ * Move object @sidx of @src into a free slot of @dst and repoint its
+ * handle. Caller holds class->lock.
+ */
+static void migrate_object(struct zs_pool *pool, struct zspage *dst,
+			struct zspage *src, unsigned int sidx)
+{
+	struct size_class *class = src->class;
+	struct zs_handle *zh = (struct zs_handle *)src->handles[sidx];
+	unsigned int didx;
+	char *buf;
+
+	write_lock(&pool->migrate_lock);
+
+	didx = zspage_obj_alloc(dst, zh);
+
+	/*
+	 * No object is mapped while we hold migrate_lock for writing, so
+	 * borrow this CPU's copy buffer to bounce the object through.
+	 */
+	buf = this_cpu_ptr(pool->map_area)->buf;
+	zspage_copy(src, (unsigned long)sidx * class->size, buf,
+			class->size, 0);
+	zspage_copy(dst, (unsigned long)didx * class->size, buf,
+			class->size, 1);
+
+	zh->zspage = dst;
+	zh->idx = didx;
+
+	write_unlock(&pool->migrate_lock);
+
+	/* @src still holds other objects or is emptied by the caller */
+	zspage_obj_free(src, sidx);
+}
+
+/*
+ * Repeatedly move objects from the emptiest partial zspage into the
+ * fullest one until no further zspage can be freed.
+ */
+static unsigned long zs_compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	struct zspage *zspage, *src, *dst;
+	unsigned int idx;
+	LIST_HEAD(free_list);
+
+	spin_lock(&class->lock);
+	while (class_reclaimable_pages(class)) {
+		src = dst = NULL;
+		list_for_each_entry(zspage, &class->partial, list) {
+			if (!src || zspage->inuse < src->inuse)
+				src = zspage;
+		}
+		list_for_each_entry(zspage, &class->partial, list) {
+			if (zspage == src)
+				continue;
+			if (!dst || zspage->inuse > dst->inuse)
+				dst = zspage;
+		}
+		if (!dst)
+			break;
+
+		/*
+		 * Each round either empties @src or fills @dst, so the
+		 * number of partial zspages strictly decreases.
+		 */
+		for (idx = 0; idx < class->objs_per_zspage; idx++) {
+			if (src->handles[idx] & OBJ_FREE)
+				continue;
+			migrate_object(pool, dst, src, idx);
+			if (!src->inuse || dst->inuse == class->objs_per_zspage)
+				break;
+		}
+
+		/* zspage_obj_free() has already unlinked an empty @src */
+		if (!src->inuse) {
+			list_add(&src->list, &free_list);
+			freed += class->pages_per_zspage;
+			class->pages_compacted += class->pages_per_zspage;
+		}
+
+		/* Let others at the class between zspages */
+		cond_resched_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	list_for_each_entry_safe(zspage, src, &free_list, list)
+		free_zspage(pool, zspage);
+
+	return freed;
+}
+
+/**
+ * zs_compact - migrate objects to free sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Returns the number of pages freed. Must be called from process
+ * context.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0; i--)
+		freed += zs_compact_class(pool, &pool->size_class[i]);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static unsigned long zs_reclaimable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		pages += class_reclaimable_pages(class);
+		spin_unlock(&class->lock);
+	}
+
+	return pages;
+}
+
+/*
+ * Memory pressure compacts the pool. Compaction neither allocates nor
+ * does I/O, so it is safe whatever the gfp mask of the reclaimer.
+ */
+static int zs_shrink(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	if (sc->nr_to_scan)
+		zs_compact(pool);
+
+	return min_t(unsigned long, zs_reclaimable_pages(pool), INT_MAX);
+}
+
+/**
+ * zs_pool_stats - per size class fragmentation statistics
+ * @pool: pool to report on
+ * @buf: output buffer
+ * @len: size of @buf
+ *
+ * Only classes with allocated zspages are listed.
+ */
+ssize_t zs_pool_stats(struct zs_pool *pool, char *buf, size_t len)
+{
+	int i;
+	ssize_t sz;
+
+	sz = scnprintf(buf, len, "%5s %5s %5s %5s %9s %11s %11s %9s %9s\n",
+			"class", "size", "objs", "pages", "zspages",
+			"obj_alloced", "obj_used", "pages_rcl", "compacted");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long nr_zspages, objs_inuse, reclaimable, compacted;
+
+		spin_lock(&class->lock);
+		nr_zspages = class->nr_zspages;
+		objs_inuse = class->objs_inuse;
+		reclaimable = class_reclaimable_pages(class);
+		compacted = class->pages_compacted;
+		spin_unlock(&class->lock);
+
+		if (!nr_zspages && !compacted)
+			continue;
+
+		sz += scnprintf(buf + sz, len - sz,
+			"%5d %5u %5u %5u %9lu %11lu %11lu %9lu %9lu\n",
+			i, class->size, class->objs_per_zspage,
+			class->pages_per_zspage, nr_zspages,
+			nr_zspages * class->objs_per_zspage, objs_inuse,
+			reclaimable, compacted);
+	}
+
+	return sz;
+}
+EXPORT_SYMBOL_GPL(zs_pool_stats);
+
+static void zs_free_map_areas(struct zs_pool *pool)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+	free_percpu(pool->map_area);
+}
+
+/**
+ * zs_create_pool - Creates an allocation pool to work from.
+ * @name: name of the pool to be created
+ * @flags: allocation flags used when growing pool
+ *
+ * This function must be called before anything when using
+ * the zsmalloc allocator.
+ *
+ * On success, a pointer to the newly created pool is returned,
+ * otherwise NULL.
+ */
+struct zs_pool *zs_create_pool(const char *name, gfp_t flags)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+		class->index = i;
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+					PAGE_SIZE / class->size;
+	}
+
+	rwlock_init(&pool->migrate_lock);
+	pool->flags = flags;
+	atomic_set(&pool->pages_allocated, 0);
+
+	/* The cache keeps a reference to its name */
+	pool->name = kasprintf(GFP_KERNEL, "zs_handle-%s", name);
+	if (!pool->name)
+		goto fail_name;
+
+	pool->handle_cache = kmem_cache_create(pool->name,
+				sizeof(struct zs_handle), 0, 0, NULL);
+	if (!pool->handle_cache)
+		goto fail_cache;
+
+	pool->map_area = alloc_percpu(struct mapping_area);
+	if (!pool->map_area)
+		goto fail_area;
+
+	for_each_possible_cpu(cpu) {
+		struct mapping_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail_buf;
+	}
+
+	pool->shrinker.shrink = zs_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	return pool;
+
+fail_buf:
+	zs_free_map_areas(pool);
+fail_area:
+	kmem_cache_destroy(pool->handle_cache);
+fail_cache:
+	kfree(pool->name);
+fail_name:
+	kfree(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i;
+	struct zspage *zspage, *tmp;
+
+	unregister_shrinker(&pool->shrinker);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		if (class->objs_inuse)
+			pr_info("Freeing non-empty class %u of size %u\n",
+				i, class->size);
+
+		list_for_each_entry_safe(zspage, tmp, &class->partial, list)
+			free_zspage(pool, zspage);
+		list_for_each_entry_safe(zspage, tmp, &class->full, list)
+			free_zspage(pool, zspage);
+	}
+
+	zs_free_map_areas(pool);
+	kmem_cache_destroy(pool->handle_cache);
+	kfree(pool->name);
+	kfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("zsmalloc memory allocator");
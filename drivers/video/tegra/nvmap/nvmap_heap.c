@@ -27,6 +27,8 @@
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/err.h>
+#include <linux/bitops.h>
+#include <linux/ktime.h>
 
 #include <linux/nvmap.h>
 #include "nvmap.h"
@@ -52,7 +54,13 @@
  *
  * o "normal" allocations use an address-order first-fit allocator (called
  *   BOTTOM_UP in the code below). each allocation is rounded up to be
- *   an integer multiple of the "small" allocation size.
+ *   an integer multiple of the "small" allocation size. free blocks are
+ *   also kept in power-of-two size-class bins, each sorted by address,
+ *   with a bitmap of the non-empty bins; the search starts at the bin of
+ *   the requested size and takes the lowest fitting block of the first
+ *   bin that has one, so it does not have to walk past the free blocks of
+ *   the smaller bins. keeping a bin sorted makes inserting a free block
+ *   linear in the length of its bin.
  *
  * o "huge" allocations use an address-order last-fit allocator (called
  *   TOP_DOWN in the code below). like "normal" allocations, each allocation
@@ -71,6 +79,7 @@
  */
 
 #define MAX_BUDDY_NR	128	/* maximum buddies in a buddy allocator */
+#define NR_SIZE_BINS	BITS_PER_LONG	/* bins of [2^n, 2^(n+1)) */
 
 enum direction {
 	TOP_DOWN,
@@ -112,6 +121,7 @@ struct list_block {
 	size_t align;
 	struct nvmap_heap *heap;
 	struct list_head free_list;
+	struct list_head bin_list;
 };
 
 struct combo_block {
@@ -136,6 +146,11 @@ struct buddy_heap {
 struct nvmap_heap {
 	struct list_head all_list;
 	struct list_head free_list;
+	struct list_head bins[NR_SIZE_BINS];
+	unsigned long bin_map;		/* non-empty bins */
+	unsigned int alloc_count;	/* allocation latency statistics */
+	u64 alloc_ns_total;
+	u64 alloc_ns_max;
 	struct mutex lock;
 	struct list_head buddy_list;
 	unsigned int min_buddy_shift;
@@ -160,6 +175,65 @@ static inline unsigned int order_of(size_t len, size_t min_shift)
 	return fls(len)-1;
 }
 
+static inline unsigned int bin_of(size_t size)
+{
+	return fls_long(size) - 1;
+}
+
+/* adds free block b to its size-class bin; must hold the heap lock.
+ * the bin is kept sorted by address so that the first fit in a bin is
+ * also the lowest one, at the cost of a walk over the bin. */
+static void bin_insert(struct nvmap_heap *heap, struct list_block *b)
+{
+	unsigned int bin = bin_of(b->size);
+	struct list_block *n;
+
+	list_for_each_entry(n, &heap->bins[bin], bin_list) {
+		if (n->block.base > b->block.base)
+			break;
+	}
+	list_add_tail(&b->bin_list, &n->bin_list);
+	__set_bit(bin, &heap->bin_map);
+}
+
+/* removes free block b from its bin; b->size must not have changed since
+ * bin_insert(). must hold the heap lock. */
+static void bin_remove(struct nvmap_heap *heap, struct list_block *b)
+{
+	unsigned int bin = bin_of(b->size);
+
+	list_del_init(&b->bin_list);
+	if (list_empty(&heap->bins[bin]))
+		__clear_bit(bin, &heap->bin_map);
+}
+
+/* finds the free block for a BOTTOM_UP allocation. the bins are scanned
+ * from the bin of len upwards and each block is checked against len plus
+ * its alignment padding: the first bin also holds blocks smaller than
+ * len. in the higher bins every block is larger than len, so once the
+ * padding fits as well the head of the bin is taken. */
+static struct list_block *bin_fit(struct nvmap_heap *heap, size_t len,
+				  size_t align, unsigned long *fix_base)
+{
+	struct list_block *i;
+	unsigned int bin;
+
+	for (bin = find_next_bit(&heap->bin_map, NR_SIZE_BINS, bin_of(len));
+	     bin < NR_SIZE_BINS;
+	     bin = find_next_bit(&heap->bin_map, NR_SIZE_BINS, bin + 1)) {
+		list_for_each_entry(i, &heap->bins[bin], bin_list) {
+			unsigned long base = ALIGN(i->block.base, align);
+
+			if (base - i->block.base + len <= i->size) {
+				*fix_base = base;
+				return i;
+			}
+		}
+	}
+
+	return NULL;
+}
+
 /* returns the free size in bytes of the buddy heap; must be called while
  * holding the parent heap's lock. */
 static void buddy_stat(struct buddy_heap *heap, struct heap_stat *stat)
@@ -247,6 +321,12 @@ static struct device_attribute heap_stat_free_size =
 static struct device_attribute heap_stat_base =
 	__ATTR(base, S_IRUGO, heap_stat_show, NULL);
 
+static struct device_attribute heap_stat_bins =
+	__ATTR(bins, S_IRUGO, heap_stat_show, NULL);
+
+static struct device_attribute heap_stat_alloc_latency =
+	__ATTR(alloc_latency, S_IRUGO, heap_stat_show, NULL);
+
 static struct device_attribute heap_attr_name =
 	__ATTR(name, S_IRUGO, heap_name_show, NULL);
 
@@ -258,6 +338,8 @@ static struct attribute *heap_stat_attrs[] = {
 	&heap_stat_free_count.attr,
 	&heap_stat_free_size.attr,
 	&heap_stat_base.attr,
+	&heap_stat_bins.attr,
+	&heap_stat_alloc_latency.attr,
 	&heap_attr_name.attr,
 	NULL,
 };
@@ -274,6 +356,47 @@ static ssize_t heap_name_show(struct device *dev,
 	return sprintf(buf, "%s\n", heap->name);
 }
 
+/* one line per non-empty size-class bin: bin size, free blocks, free bytes */
+static ssize_t heap_bins_show(struct nvmap_heap *heap, char *buf)
+{
+	struct list_block *l;
+	unsigned int bin;
+	ssize_t len = 0;
+
+	mutex_lock(&heap->lock);
+	for_each_set_bit(bin, &heap->bin_map, NR_SIZE_BINS) {
+		size_t count = 0, size = 0;
+
+		list_for_each_entry(l, &heap->bins[bin], bin_list) {
+			count++;
+			size += l->size;
+		}
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%lu %zu %zu\n",
+				 1ul << bin, count, size);
+	}
+	mutex_unlock(&heap->lock);
+
+	return len;
+}
+
+/* allocations, average and worst allocation latency in ns */
+static ssize_t heap_latency_show(struct nvmap_heap *heap, char *buf)
+{
+	unsigned int count;
+	u64 avg, max;
+
+	mutex_lock(&heap->lock);
+	count = heap->alloc_count;
+	avg = heap->alloc_ns_total;
+	max = heap->alloc_ns_max;
+	mutex_unlock(&heap->lock);
+
+	if (count)
+		do_div(avg, count);
+
+	return sprintf(buf, "%u %llu %llu\n", count, avg, max);
+}
+
 static ssize_t heap_stat_show(struct device *dev,
 			      struct device_attribute *attr, char *buf)
 {
@@ -281,6 +404,11 @@ static ssize_t heap_stat_show(struct device *dev,
 	struct heap_stat stat;
 	unsigned long base;
 
+	if (attr == &heap_stat_bins)
+		return heap_bins_show(heap, buf);
+	else if (attr == &heap_stat_alloc_latency)
+		return heap_latency_show(heap, buf);
+
 	base = heap_stat(heap, &stat);
 
 	if (attr == &heap_stat_total_max)
@@ -416,7 +544,9 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 	dir = (len <= heap->small_alloc) ? BOTTOM_UP : TOP_DOWN;
 #endif
 
-	if (dir == BOTTOM_UP) {
+	if (dir == BOTTOM_UP && !base_max) {
+		b = bin_fit(heap, len, align, &fix_base);
+	} else if (dir == BOTTOM_UP) {
 		list_for_each_entry(i, &heap->free_list, free_list) {
 			size_t fix_size;
 			fix_base = ALIGN(i->block.base, align);
@@ -448,6 +578,8 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 	if (!b)
 		return NULL;
 
+	bin_remove(heap, b);
+
 	if (dir == BOTTOM_UP)
 		b->block.type = BLOCK_FIRST_FIT;
 
@@ -471,6 +603,7 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 		b->size -= rem->size;
 		list_add_tail(&rem->all_list,  &b->all_list);
 		list_add_tail(&rem->free_list, &b->free_list);
+		bin_insert(heap, rem);
 	}
 
 	b->orig_addr = b->block.base;
@@ -489,6 +622,7 @@ static struct nvmap_heap_block *do_heap_alloc(struct nvmap_heap *heap,
 		b->size = len;
 		list_add(&rem->all_list,  &b->all_list);
 		list_add(&rem->free_list, &b->free_list);
+		bin_insert(heap, rem);
 	}
 
 out:
@@ -548,6 +682,7 @@ static struct list_block *do_heap_free(struct nvmap_heap_block *block)
 	if (!list_is_last(&b->free_list, &heap->free_list)) {
 		n = list_first_entry(&b->free_list, struct list_block, free_list);
 		if (n->block.base == b->block.base + b->size) {
+			bin_remove(heap, n);
 			list_del(&n->all_list);
 			list_del(&n->free_list);
 			BUG_ON(b->orig_addr >= n->orig_addr);
@@ -561,6 +696,7 @@ static struct list_block *do_heap_free(struct nvmap_heap_block *block)
 	if (b->free_list.prev != &heap->free_list) {
 		n = list_entry(b->free_list.prev, struct list_block, free_list);
 		if (n->block.base + n->size == b->block.base) {
+			bin_remove(heap, n);
 			list_del(&b->all_list);
 			list_del(&b->free_list);
 			BUG_ON(n->orig_addr >= b->orig_addr);
@@ -570,6 +706,8 @@ static struct list_block *do_heap_free(struct nvmap_heap_block *block)
 		}
 	}
 
+	bin_insert(heap, b);
+
 	freelist_debug(heap, "free list after", b);
 	b->block.type = BLOCK_EMPTY;
 	return b;
@@ -850,8 +988,11 @@ struct nvmap_heap_block *nvmap_heap_alloc(struct nvmap_heap *h,
 	size_t len        = handle->size;
 	size_t align      = handle->align;
 	unsigned int prot = handle->flags;
+	ktime_t start;
+	u64 ns;
 
 	mutex_lock(&h->lock);
+	start = ktime_get();
 
 #ifdef CONFIG_NVMAP_CARVEOUT_COMPACTOR
 	/* Align to page size */
@@ -883,6 +1024,11 @@ struct nvmap_heap_block *nvmap_heap_alloc(struct nvmap_heap *h,
 		b->handle = handle;
 		handle->carveout = b;
 	}
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	h->alloc_count++;
+	h->alloc_ns_total += ns;
+	h->alloc_ns_max = max(h->alloc_ns_max, ns);
 	mutex_unlock(&h->lock);
 	return b;
 }
@@ -944,6 +1090,7 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 {
 	struct nvmap_heap *h = NULL;
 	struct list_block *l = NULL;
+	unsigned int i;
 
 	if (WARN_ON(buddy_size && buddy_size < NVMAP_HEAP_MIN_BUDDY_SIZE)) {
 		dev_warn(parent, "%s: buddy_size %u too small\n", __func__,
@@ -1007,6 +1154,8 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 	INIT_LIST_HEAD(&h->free_list);
 	INIT_LIST_HEAD(&h->buddy_list);
 	INIT_LIST_HEAD(&h->all_list);
+	for (i = 0; i < NR_SIZE_BINS; i++)
+		INIT_LIST_HEAD(&h->bins[i]);
 	mutex_init(&h->lock);
 	l->block.base = base;
 	l->block.type = BLOCK_EMPTY;
@@ -1014,6 +1163,7 @@ struct nvmap_heap *nvmap_heap_create(struct device *parent, const char *name,
 	l->orig_addr = base;
 	list_add_tail(&l->free_list, &h->free_list);
 	list_add_tail(&l->all_list, &h->all_list);
+	bin_insert(h, l);
 
 	inner_flush_cache_all();
 	outer_flush_range(base, base + len);
@@ -17,6 +17,19 @@
 #include <linux/io.h>
 #include <linux/mmc/host.h>
 
+/*
+ * DMA state of a request prepared ahead of time by the pre_req hook,
+ * while the previous request is still being transferred.
+ */
+struct sdhci_host_next {
+	unsigned int	sg_count;	/* Mapped sg entries */
+	int		slot;		/* ADMA table slot */
+	bool		pending;	/* Prepared but not yet issued */
+	s32		cookie;
+	dma_addr_t	adma_addr;	/* Mapped ADMA descr. table */
+	dma_addr_t	align_addr;	/* Mapped bounce buffer */
+};
+
 struct sdhci_host {
 	/* Data set by hardware interface driver */
 	const char *hw_name;	/* Hardware bus name */
@@ -141,12 +154,15 @@ struct sdhci_host {
 
 	int sg_count;		/* Mapped sg entries */
 
-	u8 *adma_desc;		/* ADMA descriptor table */
-	u8 *align_buffer;	/* Bounce buffer */
+	u8 *adma_desc;		/* ADMA descriptor tables */
+	u8 *align_buffer;	/* Bounce buffers */
+	int adma_slot;		/* Table slot of current request */
 
 	dma_addr_t adma_addr;	/* Mapped ADMA descr. table */
 	dma_addr_t align_addr;	/* Mapped bounce buffer */
 
+	struct sdhci_host_next next_data;	/* Prepared by pre_req */
+
 	struct tasklet_struct card_tasklet;	/* Tasklet structures */
 	struct tasklet_struct finish_tasklet;
 
@@ -66,6 +66,28 @@ static inline void oom_killer_enable(void)
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * Keep the Android lowmemorykiller's per-oom_adj process index in sync.
+ * Called without task_lock() held on the task's group leader.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_index_add(struct task_struct *p);
+extern void lowmem_index_del(struct task_struct *p);
+extern void lowmem_index_update(struct task_struct *p);
+#else
+static inline void lowmem_index_add(struct task_struct *p)
+{
+}
+
+static inline void lowmem_index_del(struct task_struct *p)
+{
+}
+
+static inline void lowmem_index_update(struct task_struct *p)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
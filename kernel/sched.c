@@ -3295,29 +3295,37 @@ unsigned long nr_iowait(void)
 	return sum;
 }
 
-unsigned long avg_nr_running(void)
+/*
+ * Decaying average of the run-queue depth of one cpu, in FSHIFT fixed
+ * point.
+ */
+unsigned long avg_cpu_nr_running(unsigned int cpu)
 {
-	unsigned long i, sum = 0;
+	struct rq *q = cpu_rq(cpu);
 	unsigned int seqcnt, ave_nr_running;
 
-	for_each_online_cpu(i) {
-		struct rq *q = cpu_rq(i);
+	/*
+	 * Update average to avoid reading stalled value if there were
+	 * no run-queue changes for a long time. On the other hand if
+	 * the changes are happening right now, just read current value
+	 * directly.
+	 */
+	seqcnt = read_seqcount_begin(&q->ave_seqcnt);
+	ave_nr_running = do_avg_nr_running(q);
+	if (read_seqcount_retry(&q->ave_seqcnt, seqcnt)) {
+		read_seqcount_begin(&q->ave_seqcnt);
+		ave_nr_running = q->ave_nr_running;
+	}
 
-		/*
-		 * Update average to avoid reading stalled value if there were
-		 * no run-queue changes for a long time. On the other hand if
-		 * the changes are happening right now, just read current value
-		 * directly.
-		 */
-		seqcnt = read_seqcount_begin(&q->ave_seqcnt);
-		ave_nr_running = do_avg_nr_running(q);
-		if (read_seqcount_retry(&q->ave_seqcnt, seqcnt)) {
-			read_seqcount_begin(&q->ave_seqcnt);
-			ave_nr_running = q->ave_nr_running;
-		}
+	return ave_nr_running;
+}
 
-		sum += ave_nr_running;
-	}
+unsigned long avg_nr_running(void)
+{
+	unsigned long i, sum = 0;
+
+	for_each_online_cpu(i)
+		sum += avg_cpu_nr_running(i);
 
 	return sum;
 }
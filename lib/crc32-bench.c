@@ -0,0 +1,95 @@
+/*
+ * Throughput of the CRC32 library functions
+ *
+ * Loading the module times crc32_le, crc32_be and __crc32c_le over
+ * buffers of 64 bytes to 64KB and prints MB/s for each, e.g. to compare
+ * the implementations selectable in Kconfig or the effect of NEON.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/crc32.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#define CRC32_BENCH_MAX		65536
+/* Bytes to checksum per function and buffer size */
+#define CRC32_BENCH_BYTES	(16 << 20)
+
+static const struct {
+	const char *name;
+	u32 (*fn)(u32 crc, unsigned char const *p, size_t len);
+} crc32_bench_fns[] = {
+	{ "crc32_le",	crc32_le },
+	{ "crc32_be",	crc32_be },
+	{ "crc32c",	__crc32c_le },
+};
+
+static unsigned int __init crc32_bench_one(int f, const u8 *buf, size_t len)
+{
+	unsigned int i, loops = CRC32_BENCH_BYTES / len;
+	u32 crc = ~0;
+	ktime_t start;
+	s64 ns;
+
+	/* Warm up the tables and the buffer */
+	crc = crc32_bench_fns[f].fn(crc, buf, len);
+
+	start = ktime_get();
+	for (i = 0; i < loops; i++)
+		crc = crc32_bench_fns[f].fn(crc, buf, len);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* Keep the result live */
+	if (crc == 0x12345678)
+		pr_debug("crc32_bench: %08x\n", crc);
+
+	/* Bytes per ns * 1000 is MB/s */
+	return ns ? div64_u64((u64)loops * len * 1000, ns) : 0;
+}
+
+static int __init crc32_bench_init(void)
+{
+	size_t len;
+	u8 *buf;
+	int f;
+
+	buf = kmalloc(CRC32_BENCH_MAX, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, CRC32_BENCH_MAX);
+
+	pr_info("crc32_bench: %8s %10s %10s %10s (MB/s)\n", "bytes",
+		crc32_bench_fns[0].name, crc32_bench_fns[1].name,
+		crc32_bench_fns[2].name);
+
+	for (len = 64; len <= CRC32_BENCH_MAX; len *= 4) {
+		unsigned int mbs[ARRAY_SIZE(crc32_bench_fns)];
+
+		for (f = 0; f < ARRAY_SIZE(crc32_bench_fns); f++)
+			mbs[f] = crc32_bench_one(f, buf, len);
+
+		pr_info("crc32_bench: %8zu %10u %10u %10u\n",
+			len, mbs[0], mbs[1], mbs[2]);
+	}
+
+	kfree(buf);
+	return 0;
+}
+
+static void __exit crc32_bench_exit(void)
+{
+}
+
+module_init(crc32_bench_init);
+module_exit(crc32_bench_exit);
+
+MODULE_DESCRIPTION("CRC32 throughput benchmark");
+MODULE_LICENSE("GPL");
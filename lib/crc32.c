@@ -28,13 +28,13 @@
 #include <linux/init.h>
 #include <linux/atomic.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
+#if CRC_LE_BITS > 8
 # define tole(x) __constant_cpu_to_le32(x)
 #else
 # define tole(x) (x)
 #endif
 
-#if CRC_BE_BITS == 8
+#if CRC_BE_BITS > 8
 # define tobe(x) __constant_cpu_to_be32(x)
 #else
 # define tobe(x) (x)
@@ -42,29 +42,35 @@
 #include "crc32table.h"
 
 MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
-MODULE_DESCRIPTION("Ethernet CRC32 calculations");
+MODULE_DESCRIPTION("Various CRC32 calculations");
 MODULE_LICENSE("GPL");
 
-#if CRC_LE_BITS == 8 || CRC_BE_BITS == 8
+#if CRC_LE_BITS > 8 || CRC_BE_BITS > 8
 
+/* implements slicing-by-4 or slicing-by-8 algorithm */
 static inline u32
 crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 {
 # ifdef __LITTLE_ENDIAN
-#  define DO_CRC(x) crc = tab[0][(crc ^ (x)) & 255] ^ (crc >> 8)
-#  define DO_CRC4 crc = tab[3][(crc) & 255] ^ \
-		tab[2][(crc >> 8) & 255] ^ \
-		tab[1][(crc >> 16) & 255] ^ \
-		tab[0][(crc >> 24) & 255]
+#  define DO_CRC(x) crc = t0[(crc ^ (x)) & 255] ^ (crc >> 8)
+#  define DO_CRC4 (t3[(q) & 255] ^ t2[(q >> 8) & 255] ^ \
+		   t1[(q >> 16) & 255] ^ t0[(q >> 24) & 255])
+#  define DO_CRC8 (t7[(q) & 255] ^ t6[(q >> 8) & 255] ^ \
+		   t5[(q >> 16) & 255] ^ t4[(q >> 24) & 255])
 # else
-#  define DO_CRC(x) crc = tab[0][((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
-#  define DO_CRC4 crc = tab[0][(crc) & 255] ^ \
-		tab[1][(crc >> 8) & 255] ^ \
-		tab[2][(crc >> 16) & 255] ^ \
-		tab[3][(crc >> 24) & 255]
+#  define DO_CRC(x) crc = t0[((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+#  define DO_CRC4 (t0[(q) & 255] ^ t1[(q >> 8) & 255] ^ \
+		   t2[(q >> 16) & 255] ^ t3[(q >> 24) & 255])
+#  define DO_CRC8 (t4[(q) & 255] ^ t5[(q >> 8) & 255] ^ \
+		   t6[(q >> 16) & 255] ^ t7[(q >> 24) & 255])
 # endif
 	const u32 *b;
 	size_t    rem_len;
+	const u32 *t0 = tab[0], *t1 = tab[1], *t2 = tab[2], *t3 = tab[3];
+# if CRC_LE_BITS != 32
+	const u32 *t4 = tab[4], *t5 = tab[5], *t6 = tab[6], *t7 = tab[7];
+# endif
+	u32 q;
 
 	/* Align it */
 	if (unlikely((long)buf & 3 && len)) {
@@ -72,13 +78,30 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 			DO_CRC(*buf++);
 		} while ((--len) && ((long)buf)&3);
 	}
+
+# if CRC_LE_BITS == 32
 	rem_len = len & 3;
-	/* load data 32 bits wide, xor data 32 bits wide. */
 	len = len >> 2;
+# else
+	rem_len = len & 7;
+	len = len >> 3;
+# endif
+
+	/*
+	 * Load data 32 bits wide, xor data 32 bits wide.  Slicing by 8
+	 * looks up the second word without the crc, so the eight lookups
+	 * of an iteration do not depend on each other.
+	 */
 	b = (const u32 *)buf;
 	for (--b; len; --len) {
-		crc ^= *++b; /* use pre increment for speed */
-		DO_CRC4;
+		q = crc ^ *++b; /* use pre increment for speed */
+# if CRC_LE_BITS == 32
+		crc = DO_CRC4;
+# else
+		crc = DO_CRC8;
+		q = *++b;
+		crc ^= DO_CRC4;
+# endif
 	}
 	len = rem_len;
 	/* And the last few bytes */
@@ -91,80 +114,168 @@ crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256])
 	return crc;
 #undef DO_CRC
 #undef DO_CRC4
+#undef DO_CRC8
 }
 #endif
+
 /**
- * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
+ * crc32_le_generic() - Calculate bitwise little-endian CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
  *	other uses, or the previous crc32 value if computing incrementally.
  * @p: pointer to buffer over which CRC is run
  * @len: length of buffer @p
+ * @tab: little-endian table for @polynomial
+ * @polynomial: CRC32 LE polynomial
  */
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len);
-
-#if CRC_LE_BITS == 1
-/*
- * In fact, the table-based code will work in this case, but it can be
- * simplified by inlining the table in ?: form.
- */
-
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+static inline u32 __pure crc32_le_generic(u32 crc, unsigned char const *p,
+					  size_t len, const u32 (*tab)[256],
+					  u32 polynomial)
 {
+#if CRC_LE_BITS == 1
+	/*
+	 * In fact, the table-based code will work in this case, but it can
+	 * be simplified by inlining the table in ?: form.
+	 */
 	int i;
 	while (len--) {
 		crc ^= *p++;
 		for (i = 0; i < 8; i++)
-			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+			crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+	}
+# elif CRC_LE_BITS == 2
+	while (len--) {
+		crc ^= *p++;
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
 	}
-	return crc;
-}
-#else				/* Table-based approach */
-
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
-{
-# if CRC_LE_BITS == 8
-	const u32      (*tab)[] = crc32table_le;
-
-	crc = __cpu_to_le32(crc);
-	crc = crc32_body(crc, p, len, tab);
-	return __le32_to_cpu(crc);
 # elif CRC_LE_BITS == 4
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
-		crc = (crc >> 4) ^ crc32table_le[crc & 15];
+		crc = (crc >> 4) ^ tab[0][crc & 15];
+		crc = (crc >> 4) ^ tab[0][crc & 15];
 	}
-	return crc;
-# elif CRC_LE_BITS == 2
+# elif CRC_LE_BITS == 8
+	/* aka Sarwate algorithm */
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
-		crc = (crc >> 2) ^ crc32table_le[crc & 3];
+		crc = (crc >> 8) ^ tab[0][crc & 255];
 	}
+# else
+	crc = __cpu_to_le32(crc);
+	crc = crc32_body(crc, p, len, tab);
+	crc = __le32_to_cpu(crc);
+#endif
 	return crc;
-# endif
+}
+
+#ifdef CONFIG_CRC32_NEON
+#include <linux/hardirq.h>
+#include <asm/neon.h>
+
+/* Below this, saving the VFP state costs more than NEON saves. */
+#define CRC32_NEON_MIN		512
+#define CRC32_NEON_BLOCK	64
+
+/*
+ * Bit reflected x^543, x^479, x^159 and x^95 modulo the polynomial:
+ * the constants for folding 512 and 128 bits at a time.
+ */
+static const u32 crc32_fold_le[4] = {
+	0x8f352d95, 0x1d9513d7, 0xae689191, 0xccaa009e
+};
+static const u32 crc32c_fold_le[4] = {
+	0x740eef02, 0x9e4addf8, 0xf20c0dfe, 0x493c7d27
+};
+
+asmlinkage void crc32_neon_fold(u8 *acc, const u8 *p, unsigned int blocks,
+				const u32 *k);
+
+static inline bool crc32_use_neon(size_t len)
+{
+	/* kernel_neon_begin() is fine in softirq, but not in hardirq */
+	return len >= CRC32_NEON_MIN && cpu_has_neon() &&
+		!in_irq() && !irqs_disabled();
+}
+
+/*
+ * NEON folds the bulk of the buffer down to 16 bytes that leave the
+ * same remainder; the table code then takes care of those and of the
+ * bytes that do not fill a whole block.
+ */
+static u32 crc32_le_neon(u32 crc, unsigned char const *p, size_t len,
+			 const u32 (*tab)[256], u32 polynomial, const u32 *k)
+{
+	unsigned int blocks = len / CRC32_NEON_BLOCK;
+	__le32 acc[4] = { cpu_to_le32(crc), };
+
+	kernel_neon_begin();
+	crc32_neon_fold((u8 *)acc, p, blocks, k);
+	kernel_neon_end();
+
+	crc = crc32_le_generic(0, (u8 *)acc, sizeof(acc), tab, polynomial);
+	return crc32_le_generic(crc, p + blocks * CRC32_NEON_BLOCK,
+				len % CRC32_NEON_BLOCK, tab, polynomial);
 }
 #endif
 
+#if CRC_LE_BITS == 1
+# define crc32table_le		NULL
+# define crc32ctable_le		NULL
+#endif
+
 /**
- * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
+ * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
  *	other uses, or the previous crc32 value if computing incrementally.
  * @p: pointer to buffer over which CRC is run
  * @len: length of buffer @p
  */
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len);
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+	const u32 (*tab)[256] = (const u32 (*)[256])crc32table_le;
 
-#if CRC_BE_BITS == 1
-/*
- * In fact, the table-based code will work in this case, but it can be
- * simplified by inlining the table in ?: form.
+#ifdef CONFIG_CRC32_NEON
+	if (crc32_use_neon(len))
+		return crc32_le_neon(crc, p, len, tab, CRCPOLY_LE,
+				     crc32_fold_le);
+#endif
+	return crc32_le_generic(crc, p, len, tab, CRCPOLY_LE);
+}
+
+/**
+ * __crc32c_le() - Calculate bitwise little-endian Castagnoli CRC32
+ * @crc: seed value for computation, or the previous crc32c value if
+ *	computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ *
+ * This is the raw function behind the "crc32c" crypto algorithm;
+ * most users want crc32c() from <linux/crc32c.h>.
  */
+u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+{
+	const u32 (*tab)[256] = (const u32 (*)[256])crc32ctable_le;
 
+#ifdef CONFIG_CRC32_NEON
+	if (crc32_use_neon(len))
+		return crc32_le_neon(crc, p, len, tab, CRC32C_POLY_LE,
+				     crc32c_fold_le);
+#endif
+	return crc32_le_generic(crc, p, len, tab, CRC32C_POLY_LE);
+}
+
+/**
+ * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
+ * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
+ *	other uses, or the previous crc32 value if computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ */
 u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 {
+#if CRC_BE_BITS == 1
 	int i;
 	while (len--) {
 		crc ^= *p++ << 24;
@@ -173,39 +284,35 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 			    (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE :
 					  0);
 	}
-	return crc;
-}
-
-#else				/* Table-based approach */
-u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
-{
-# if CRC_BE_BITS == 8
-	const u32      (*tab)[] = crc32table_be;
-
-	crc = __cpu_to_be32(crc);
-	crc = crc32_body(crc, p, len, tab);
-	return __be32_to_cpu(crc);
+# elif CRC_BE_BITS == 2
+	while (len--) {
+		crc ^= *p++ << 24;
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+	}
 # elif CRC_BE_BITS == 4
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
-		crc = (crc << 4) ^ crc32table_be[crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
 	}
-	return crc;
-# elif CRC_BE_BITS == 2
+# elif CRC_BE_BITS == 8
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
-		crc = (crc << 2) ^ crc32table_be[crc >> 30];
+		crc = (crc << 8) ^ crc32table_be[0][crc >> 24];
 	}
-	return crc;
+# else
+	crc = __cpu_to_be32(crc);
+	crc = crc32_body(crc, p, len, crc32table_be);
+	crc = __be32_to_cpu(crc);
 # endif
+	return crc;
 }
-#endif
 
 EXPORT_SYMBOL(crc32_le);
+EXPORT_SYMBOL(__crc32c_le);
 EXPORT_SYMBOL(crc32_be);
 
 /*
@@ -469,3 +576,97 @@ int main(void)
 }
 
 #endif				/* UNITTEST */
+
+#ifdef CONFIG_CRC32_SELFTEST
+
+#include <linux/random.h>
+#include <linux/slab.h>
+
+#define CRC32_TEST_BUF		8192
+#define CRC32_TEST_LOOPS	100
+
+/* Bit at a time references for the table and NEON code */
+static u32 __init crc32_le_ref(u32 crc, unsigned char const *p, size_t len,
+			       u32 polynomial)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+	}
+	return crc;
+}
+
+static u32 __init crc32_be_ref(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^
+			      ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+/*
+ * Runs as a late initcall when built in, after the VFP support code has
+ * set up NEON, so that the NEON path gets tested as well.
+ */
+static int __init crc32_selftest(void)
+{
+	static const unsigned char check[] __initconst = "123456789";
+	unsigned char *buf;
+	int i, errors = 0;
+
+	/* The check values of the CRC catalogues */
+	if ((crc32_le(~0, check, 9) ^ ~0) != 0xcbf43926)
+		errors++;
+	if ((crc32_be(~0, check, 9) ^ ~0) != 0xfc891918)
+		errors++;
+	if ((__crc32c_le(~0, check, 9) ^ ~0) != 0xe3069283)
+		errors++;
+
+	buf = kmalloc(CRC32_TEST_BUF, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, CRC32_TEST_BUF);
+
+	/* Every other length is short, to cover the head and tail code */
+	for (i = 0; i < CRC32_TEST_LOOPS; i++) {
+		size_t off = random32() % 64;
+		size_t len = random32() % (i & 1 ? 64 : CRC32_TEST_BUF - off);
+		unsigned char *p = buf + off;
+		u32 seed = random32();
+
+		if (crc32_le(seed, p, len) !=
+		    crc32_le_ref(seed, p, len, CRCPOLY_LE))
+			errors++;
+		if (__crc32c_le(seed, p, len) !=
+		    crc32_le_ref(seed, p, len, CRC32C_POLY_LE))
+			errors++;
+		if (crc32_be(seed, p, len) != crc32_be_ref(seed, p, len))
+			errors++;
+	}
+
+	kfree(buf);
+
+	if (errors)
+		pr_warn("crc32: self test failed, %d errors\n", errors);
+	else
+		pr_info("crc32: self tests passed\n");
+
+	return 0;
+}
+
+static void __exit crc32_exit(void)
+{
+}
+
+late_initcall(crc32_selftest);
+module_exit(crc32_exit);
+
+#endif /* CONFIG_CRC32_SELFTEST */
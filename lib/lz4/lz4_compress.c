@@ -0,0 +1,128 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ *
+ * Block format compatible with the reference implementation by
+ * Yann Collet (http://code.google.com/p/lz4/): each sequence is a token
+ * (4 bits literal run, 4 bits match length), the literals, a 16-bit
+ * little endian back-reference offset and the match length extension.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/lz4.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+static inline unsigned char *lz4_put_length(unsigned char *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+
+	return op;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const unsigned char *ip = src, *anchor = src, *ref;
+	const unsigned char * const iend = src + src_len;
+	const unsigned char * const mflimit = iend - MFLIMIT;
+	const unsigned char * const matchlimit = iend - LASTLITERALS;
+	unsigned char *op = dst, *token;
+	u32 *hash_table = wrkmem;
+	size_t len;
+	u32 h;
+
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	/*
+	 * Positions are stored relative to src, so a cleared table makes
+	 * every slot point at the start of the block; candidates are
+	 * always verified before use.
+	 */
+	memset(hash_table, 0, LZ4_MEM_COMPRESS);
+	ip++;
+
+	while (ip < mflimit) {
+		const unsigned char *mstart;
+
+		h = LZ4_HASH32(ip);
+		ref = src + hash_table[h];
+		hash_table[h] = ip - src;
+
+		if (ip - ref > MAX_DISTANCE || ref == ip ||
+		    LZ4_READ32(ref) != LZ4_READ32(ip)) {
+			ip++;
+			continue;
+		}
+
+		/* Catch up with bytes that already match backwards */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		/* Literal run */
+		len = ip - anchor;
+		token = op++;
+		if (len >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, len - RUN_MASK);
+		} else
+			*token = len << ML_BITS;
+		memcpy(op, anchor, len);
+		op += len;
+
+		/* Offset */
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		/* Match length */
+		mstart = ip;
+		ip += MINMATCH;
+		ref += MINMATCH;
+		while (ip < matchlimit && *ip == *ref) {
+			ip++;
+			ref++;
+		}
+
+		len = ip - mstart - MINMATCH;
+		if (len >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, len - ML_MASK);
+		} else
+			*token += len;
+
+		anchor = ip;
+		if (ip >= mflimit)
+			break;
+
+		/* Index a position inside the match for the next search */
+		hash_table[LZ4_HASH32(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	len = iend - anchor;
+	token = op++;
+	if (len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, len - RUN_MASK);
+	} else
+		*token = len << ML_BITS;
+	memcpy(op, anchor, len);
+	op += len;
+
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,27 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+
+/* Last match must start at least 12 bytes before end of block */
+#define MFLIMIT		12
+/* ... and the last 5 bytes are always literals */
+#define LASTLITERALS	5
+
+#define MAX_DISTANCE	((1 << 16) - 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define LZ4_HASH_LOG	12
+#define LZ4_HASH_SHIFT	((MINMATCH * 8) - LZ4_HASH_LOG)
+
+#define LZ4_READ32(p)	get_unaligned((const u32 *)(p))
+#define LZ4_HASH32(p)	((LZ4_READ32(p) * 2654435761U) >> LZ4_HASH_SHIFT)
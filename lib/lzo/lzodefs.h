@@ -34,10 +34,48 @@
 #define M3_MARKER	32
 #define M4_MARKER	16
 
-#define D_BITS		14
-#define D_MASK		((1u << D_BITS) - 1)
-#define D_HIGH		((D_MASK >> 1) + 1)
+/*
+ * The compressor's dictionary: D_SIZE offsets of earlier positions from
+ * the start of the block, hashed on the four bytes found there.  Blocks
+ * are at most M4_MAX_OFFSET + 1 bytes so that the offsets fit.
+ */
+#define lzo_dict_t	unsigned short
+#define D_BITS		13
+#define D_SIZE		(1u << D_BITS)
+#define D_MASK		(D_SIZE - 1)
+
+/*
+ * Word access for the copy and compare fast paths.  ARMv7 does unaligned
+ * ldr/str in hardware, but get_unaligned() goes a byte at a time there,
+ * so use the instructions directly.  Not in the boot decompressors
+ * (STATIC), which may run before the MMU and alignment setup.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7 && !defined(STATIC)
+#define LZO_FAST_UNALIGNED	1
+
+static inline u32 lzo_get32(const void *p)
+{
+	u32 v;
+
+	asm("ldr	%0, %1" : "=r" (v) : "Q" (*(const u32 *)p));
+	return v;
+}
+
+static inline void lzo_put32(void *p, u32 v)
+{
+	asm("str	%1, %0" : "=Q" (*(u32 *)p) : "r" (v));
+}
+#else
+#ifdef CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS
+#define LZO_FAST_UNALIGNED	1
+#endif
+#define lzo_get32(p)		get_unaligned((const u32 *)(p))
+#define lzo_put32(p, v)		put_unaligned((v), (u32 *)(p))
+#endif
 
-#define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
-							<< (s1)) ^ (p)[0])
-#define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
+#define COPY4(dst, src)		lzo_put32((dst), lzo_get32(src))
+#define COPY8(dst, src)					\
+	do {							\
+		COPY4((dst), (src));				\
+		COPY4((dst) + 4, (src) + 4);			\
+	} while (0)
@@ -0,0 +1,52 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6neon$#.c
+ *
+ * $#-way unrolled NEON RAID-6 syndrome generation; the loop itself is
+ * raid6_neon$#_gen_syndrome_real in neon.S
+ *
+ * This file is postprocessed using unroll.awk
+ */
+
+#include <linux/raid/pq.h>
+
+#ifdef __KERNEL__
+# include <asm/neon.h>
+#endif
+
+void raid6_neon$#_gen_syndrome_real(int disks, unsigned long bytes,
+				    void **ptrs);
+
+static void raid6_neon$#_gen_syndrome(int disks, size_t bytes, void **ptrs)
+{
+	kernel_neon_begin();
+
+	raid6_neon$#_gen_syndrome_real(disks, bytes, ptrs);
+
+	kernel_neon_end();
+}
+
+int raid6_have_neon(void);
+#if $# == 1
+int raid6_have_neon(void)
+{
+	/* This assumes either all CPUs have NEON or none does */
+	return cpu_has_neon();
+}
+#endif
+
+const struct raid6_calls raid6_neonx$# = {
+	raid6_neon$#_gen_syndrome,
+	raid6_have_neon,
+	"neonx$#",
+	0
+};
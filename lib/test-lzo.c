@@ -0,0 +1,746 @@
+/*
+ * Test cases for the LZO1X compressor and decompressor
+ *
+ * Each buffer of a generated corpus is compressed both by
+ * lzo1x_1_compress() and by the reference code below, which is the
+ * MiniLZO based compressor and decompressor lib/lzo had before they
+ * were rewritten around word copies.  Both streams must decompress to
+ * the original with both decompressors.  Truncated and corrupted
+ * streams, and output buffers that are too small, must get the same
+ * verdict from both decompressors and lzo1x_decompress_safe() must
+ * never write past the end of its output buffer.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/hrtimer.h>
+#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <asm/unaligned.h>
+#include "lzo/lzodefs.h"
+
+#define LZO_TEST_MAX	(128 * 1024 + 7)
+#define LZO_TEST_GUARD	64
+
+/* Reference compressor */
+
+#define REF_D_BITS	14
+#define REF_D_MASK	((1u << REF_D_BITS) - 1)
+#define REF_D_HIGH	((REF_D_MASK >> 1) + 1)
+#define REF_DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
+							<< (s1)) ^ (p)[0])
+#define REF_DX3(p, s1, s2, s3)	\
+		((REF_DX2((p) + 1, s2, s3) << (s1)) ^ (p)[0])
+#define REF_MEM_COMPRESS	(16384 * sizeof(unsigned char *))
+
+static noinline size_t
+ref_do_compress(const unsigned char *in, size_t in_len,
+		unsigned char *out, size_t *out_len, void *wrkmem)
+{
+	const unsigned char * const in_end = in + in_len;
+	const unsigned char * const ip_end = in + in_len - M2_MAX_LEN - 5;
+	const unsigned char ** const dict = wrkmem;
+	const unsigned char *ip = in, *ii = ip;
+	const unsigned char *end, *m, *m_pos;
+	size_t m_off, m_len, dindex;
+	unsigned char *op = out;
+
+	ip += 4;
+
+	for (;;) {
+		dindex = ((size_t)(0x21 * REF_DX3(ip, 5, 5, 6)) >> 5) &
+			 REF_D_MASK;
+		m_pos = dict[dindex];
+
+		if (m_pos < in)
+			goto literal;
+
+		if (ip == m_pos || ((size_t)(ip - m_pos) > M4_MAX_OFFSET))
+			goto literal;
+
+		m_off = ip - m_pos;
+		if (m_off <= M2_MAX_OFFSET || m_pos[3] == ip[3])
+			goto try_match;
+
+		dindex = (dindex & (REF_D_MASK & 0x7ff)) ^ (REF_D_HIGH | 0x1f);
+		m_pos = dict[dindex];
+
+		if (m_pos < in)
+			goto literal;
+
+		if (ip == m_pos || ((size_t)(ip - m_pos) > M4_MAX_OFFSET))
+			goto literal;
+
+		m_off = ip - m_pos;
+		if (m_off <= M2_MAX_OFFSET || m_pos[3] == ip[3])
+			goto try_match;
+
+		goto literal;
+
+try_match:
+		if (get_unaligned((const unsigned short *)m_pos)
+				== get_unaligned((const unsigned short *)ip)) {
+			if (likely(m_pos[2] == ip[2]))
+				goto match;
+		}
+
+literal:
+		dict[dindex] = ip;
+		++ip;
+		if (unlikely(ip >= ip_end))
+			break;
+		continue;
+
+match:
+		dict[dindex] = ip;
+		if (ip != ii) {
+			size_t t = ip - ii;
+
+			if (t <= 3) {
+				op[-2] |= t;
+			} else if (t <= 18) {
+				*op++ = (t - 3);
+			} else {
+				size_t tt = t - 18;
+
+				*op++ = 0;
+				while (tt > 255) {
+					tt -= 255;
+					*op++ = 0;
+				}
+				*op++ = tt;
+			}
+			do {
+				*op++ = *ii++;
+			} while (--t > 0);
+		}
+
+		ip += 3;
+		if (m_pos[3] != *ip++ || m_pos[4] != *ip++
+				|| m_pos[5] != *ip++ || m_pos[6] != *ip++
+				|| m_pos[7] != *ip++ || m_pos[8] != *ip++) {
+			--ip;
+			m_len = ip - ii;
+
+			if (m_off <= M2_MAX_OFFSET) {
+				m_off -= 1;
+				*op++ = (((m_len - 1) << 5)
+						| ((m_off & 7) << 2));
+				*op++ = (m_off >> 3);
+			} else if (m_off <= M3_MAX_OFFSET) {
+				m_off -= 1;
+				*op++ = (M3_MARKER | (m_len - 2));
+				goto m3_m4_offset;
+			} else {
+				m_off -= 0x4000;
+
+				*op++ = (M4_MARKER | ((m_off & 0x4000) >> 11)
+						| (m_len - 2));
+				goto m3_m4_offset;
+			}
+		} else {
+			end = in_end;
+			m = m_pos + M2_MAX_LEN + 1;
+
+			while (ip < end && *m == *ip) {
+				m++;
+				ip++;
+			}
+			m_len = ip - ii;
+
+			if (m_off <= M3_MAX_OFFSET) {
+				m_off -= 1;
+				if (m_len <= 33) {
+					*op++ = (M3_MARKER | (m_len - 2));
+				} else {
+					m_len -= 33;
+					*op++ = M3_MARKER | 0;
+					goto m3_m4_len;
+				}
+			} else {
+				m_off -= 0x4000;
+				if (m_len <= M4_MAX_LEN) {
+					*op++ = (M4_MARKER
+						| ((m_off & 0x4000) >> 11)
+						| (m_len - 2));
+				} else {
+					m_len -= M4_MAX_LEN;
+					*op++ = (M4_MARKER
+						| ((m_off & 0x4000) >> 11));
+m3_m4_len:
+					while (m_len > 255) {
+						m_len -= 255;
+						*op++ = 0;
+					}
+
+					*op++ = (m_len);
+				}
+			}
+m3_m4_offset:
+			*op++ = ((m_off & 63) << 2);
+			*op++ = (m_off >> 6);
+		}
+
+		ii = ip;
+		if (unlikely(ip >= ip_end))
+			break;
+	}
+
+	*out_len = op - out;
+	return in_end - ii;
+}
+
+static int ref_compress(const unsigned char *in, size_t in_len,
+			unsigned char *out, size_t *out_len, void *wrkmem)
+{
+	const unsigned char *ii;
+	unsigned char *op = out;
+	size_t t;
+
+	if (unlikely(in_len <= M2_MAX_LEN + 5)) {
+		t = in_len;
+	} else {
+		t = ref_do_compress(in, in_len, op, out_len, wrkmem);
+		op += *out_len;
+	}
+
+	if (t > 0) {
+		ii = in + in_len - t;
+
+		if (op == out && t <= 238) {
+			*op++ = (17 + t);
+		} else if (t <= 3) {
+			op[-2] |= t;
+		} else if (t <= 18) {
+			*op++ = (t - 3);
+		} else {
+			size_t tt = t - 18;
+
+			*op++ = 0;
+			while (tt > 255) {
+				tt -= 255;
+				*op++ = 0;
+			}
+
+			*op++ = tt;
+		}
+		do {
+			*op++ = *ii++;
+		} while (--t > 0);
+	}
+
+	*op++ = M4_MARKER | 1;
+	*op++ = 0;
+	*op++ = 0;
+
+	*out_len = op - out;
+	return LZO_E_OK;
+}
+
+/* Reference decompressor */
+
+#define HAVE_IP(x, ip_end, ip) ((size_t)(ip_end - ip) < (x))
+#define HAVE_OP(x, op_end, op) ((size_t)(op_end - op) < (x))
+#define HAVE_LB(m_pos, out, op) (m_pos < out || m_pos >= op)
+
+#define REF_COPY4(dst, src)	\
+		put_unaligned(get_unaligned((const u32 *)(src)), (u32 *)(dst))
+
+static int ref_decompress(const unsigned char *in, size_t in_len,
+			  unsigned char *out, size_t *out_len)
+{
+	const unsigned char * const ip_end = in + in_len;
+	unsigned char * const op_end = out + *out_len;
+	const unsigned char *ip = in, *m_pos;
+	unsigned char *op = out;
+	size_t t;
+
+	*out_len = 0;
+
+	if (*ip > 17) {
+		t = *ip++ - 17;
+		if (t < 4)
+			goto match_next;
+		if (HAVE_OP(t, op_end, op))
+			goto output_overrun;
+		if (HAVE_IP(t + 1, ip_end, ip))
+			goto input_overrun;
+		do {
+			*op++ = *ip++;
+		} while (--t > 0);
+		goto first_literal_run;
+	}
+
+	while ((ip < ip_end)) {
+		t = *ip++;
+		if (t >= 16)
+			goto match;
+		if (t == 0) {
+			if (HAVE_IP(1, ip_end, ip))
+				goto input_overrun;
+			while (*ip == 0) {
+				t += 255;
+				ip++;
+				if (HAVE_IP(1, ip_end, ip))
+					goto input_overrun;
+			}
+			t += 15 + *ip++;
+		}
+		if (HAVE_OP(t + 3, op_end, op))
+			goto output_overrun;
+		if (HAVE_IP(t + 4, ip_end, ip))
+			goto input_overrun;
+
+		REF_COPY4(op, ip);
+		op += 4;
+		ip += 4;
+		if (--t > 0) {
+			if (t >= 4) {
+				do {
+					REF_COPY4(op, ip);
+					op += 4;
+					ip += 4;
+					t -= 4;
+				} while (t >= 4);
+				if (t > 0) {
+					do {
+						*op++ = *ip++;
+					} while (--t > 0);
+				}
+			} else {
+				do {
+					*op++ = *ip++;
+				} while (--t > 0);
+			}
+		}
+
+first_literal_run:
+		t = *ip++;
+		if (t >= 16)
+			goto match;
+		m_pos = op - (1 + M2_MAX_OFFSET);
+		m_pos -= t >> 2;
+		m_pos -= *ip++ << 2;
+
+		if (HAVE_LB(m_pos, out, op))
+			goto lookbehind_overrun;
+
+		if (HAVE_OP(3, op_end, op))
+			goto output_overrun;
+		*op++ = *m_pos++;
+		*op++ = *m_pos++;
+		*op++ = *m_pos;
+
+		goto match_done;
+
+		do {
+match:
+			if (t >= 64) {
+				m_pos = op - 1;
+				m_pos -= (t >> 2) & 7;
+				m_pos -= *ip++ << 3;
+				t = (t >> 5) - 1;
+				if (HAVE_LB(m_pos, out, op))
+					goto lookbehind_overrun;
+				if (HAVE_OP(t + 3 - 1, op_end, op))
+					goto output_overrun;
+				goto copy_match;
+			} else if (t >= 32) {
+				t &= 31;
+				if (t == 0) {
+					if (HAVE_IP(1, ip_end, ip))
+						goto input_overrun;
+					while (*ip == 0) {
+						t += 255;
+						ip++;
+						if (HAVE_IP(1, ip_end, ip))
+							goto input_overrun;
+					}
+					t += 31 + *ip++;
+				}
+				m_pos = op - 1;
+				m_pos -= get_unaligned_le16(ip) >> 2;
+				ip += 2;
+			} else if (t >= 16) {
+				m_pos = op;
+				m_pos -= (t & 8) << 11;
+
+				t &= 7;
+				if (t == 0) {
+					if (HAVE_IP(1, ip_end, ip))
+						goto input_overrun;
+					while (*ip == 0) {
+						t += 255;
+						ip++;
+						if (HAVE_IP(1, ip_end, ip))
+							goto input_overrun;
+					}
+					t += 7 + *ip++;
+				}
+				m_pos -= get_unaligned_le16(ip) >> 2;
+				ip += 2;
+				if (m_pos == op)
+					goto eof_found;
+				m_pos -= 0x4000;
+			} else {
+				m_pos = op - 1;
+				m_pos -= t >> 2;
+				m_pos -= *ip++ << 2;
+
+				if (HAVE_LB(m_pos, out, op))
+					goto lookbehind_overrun;
+				if (HAVE_OP(2, op_end, op))
+					goto output_overrun;
+
+				*op++ = *m_pos++;
+				*op++ = *m_pos;
+				goto match_done;
+			}
+
+			if (HAVE_LB(m_pos, out, op))
+				goto lookbehind_overrun;
+			if (HAVE_OP(t + 3 - 1, op_end, op))
+				goto output_overrun;
+
+			if (t >= 2 * 4 - (3 - 1) && (op - m_pos) >= 4) {
+				REF_COPY4(op, m_pos);
+				op += 4;
+				m_pos += 4;
+				t -= 4 - (3 - 1);
+				do {
+					REF_COPY4(op, m_pos);
+					op += 4;
+					m_pos += 4;
+					t -= 4;
+				} while (t >= 4);
+				if (t > 0)
+					do {
+						*op++ = *m_pos++;
+					} while (--t > 0);
+			} else {
+copy_match:
+				*op++ = *m_pos++;
+				*op++ = *m_pos++;
+				do {
+					*op++ = *m_pos++;
+				} while (--t > 0);
+			}
+match_done:
+			t = ip[-2] & 3;
+			if (t == 0)
+				break;
+match_next:
+			if (HAVE_OP(t, op_end, op))
+				goto output_overrun;
+			if (HAVE_IP(t + 1, ip_end, ip))
+				goto input_overrun;
+
+			*op++ = *ip++;
+			if (t > 1) {
+				*op++ = *ip++;
+				if (t > 2)
+					*op++ = *ip++;
+			}
+
+			t = *ip++;
+		} while (ip < ip_end);
+	}
+
+	*out_len = op - out;
+	return LZO_E_EOF_NOT_FOUND;
+
+eof_found:
+	*out_len = op - out;
+	return (ip == ip_end ? LZO_E_OK :
+		(ip < ip_end ? LZO_E_INPUT_NOT_CONSUMED : LZO_E_INPUT_OVERRUN));
+input_overrun:
+	*out_len = op - out;
+	return LZO_E_INPUT_OVERRUN;
+
+output_overrun:
+	*out_len = op - out;
+	return LZO_E_OUTPUT_OVERRUN;
+
+lookbehind_overrun:
+	*out_len = op - out;
+	return LZO_E_LOOKBEHIND_OVERRUN;
+}
+
+/* Corpus */
+
+enum { LZO_ZERO, LZO_RANDOM, LZO_TEXT, LZO_PERIODIC, LZO_SPARSE, LZO_FAR,
+       LZO_NR_KINDS };
+
+static const char * const lzo_kind_names[] __initconst = {
+	"zero", "random", "text", "periodic", "sparse", "far",
+};
+
+static const size_t lzo_test_lens[] __initconst = {
+	0, 1, 2, 3, 4, 5, 7, 8, 9, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21,
+	22, 23, 24, 31, 32, 33, 63, 64, 65, 255, 256, 257, 1000, 4095, 4096,
+	4097, 16384, 49151, 49152, 49153, 65536, LZO_TEST_MAX,
+};
+
+static u32 lzo_seed;
+
+static u32 __init lzo_rand(void)
+{
+	lzo_seed = lzo_seed * 1664525 + 1013904223;
+	return lzo_seed >> 8;
+}
+
+static void __init lzo_fill(unsigned char *buf, size_t len, int kind)
+{
+	static const char * const words[] = {
+		"the ", "kernel ", "page ", "of ", "and ", "compressed ",
+		"data ", "to ", "zram ", "swap ", "\n", "block ", "in ", "a ",
+	};
+	size_t i, n, period;
+
+	switch (kind) {
+	case LZO_ZERO:
+		memset(buf, 0, len);
+		break;
+	case LZO_RANDOM:
+		for (i = 0; i < len; i++)
+			buf[i] = lzo_rand();
+		break;
+	case LZO_TEXT:
+		for (i = 0; i < len; i += n) {
+			const char *w = words[lzo_rand() % ARRAY_SIZE(words)];
+
+			n = min(strlen(w), len - i);
+			memcpy(buf + i, w, n);
+		}
+		break;
+	case LZO_PERIODIC:
+		period = 1 + lzo_rand() % 40;
+		for (i = 0; i < len; i++)
+			buf[i] = i < period ? lzo_rand() : buf[i - period];
+		break;
+	case LZO_SPARSE:
+		for (i = 0; i < len; i++)
+			buf[i] = lzo_rand() % 16 ? 0 : lzo_rand();
+		break;
+	case LZO_FAR:
+		/* Random runs copied from up to 48K back */
+		for (i = 0; i < len; i += n) {
+			size_t back = 1 + lzo_rand() % M4_MAX_OFFSET;
+
+			n = min_t(size_t, 3 + lzo_rand() % 300, len - i);
+			if (back <= i) {
+				size_t j;
+
+				for (j = 0; j < n; j++)
+					buf[i + j] = buf[i + j - back];
+			} else {
+				size_t j;
+
+				for (j = 0; j < n; j++)
+					buf[i + j] = lzo_rand();
+			}
+		}
+		break;
+	}
+}
+
+struct lzo_test_bufs {
+	unsigned char *src;
+	unsigned char *dst[2];		/* output of both compressors */
+	unsigned char *out[2];		/* output of both decompressors */
+	void *wrkmem;
+	void *ref_wrkmem;
+};
+
+static bool __init lzo_guard_ok(const unsigned char *p)
+{
+	int i;
+
+	for (i = 0; i < LZO_TEST_GUARD; i++)
+		if (p[i] != 0xa5)
+			return false;
+	return true;
+}
+
+/*
+ * Decompress @src with both decompressors into buffers of @out_len bytes
+ * and check that they agree.  Returns the result of lzo1x_decompress_safe
+ * or 1 if the two disagree or the guard area got overwritten.
+ */
+static int __init lzo_decompress_both(struct lzo_test_bufs *b,
+				      const unsigned char *src,
+				      size_t src_len, size_t out_len)
+{
+	size_t len[2] = { out_len, out_len };
+	int ret[2];
+
+	memset(b->out[0] + out_len, 0xa5, LZO_TEST_GUARD);
+	ret[0] = lzo1x_decompress_safe(src, src_len, b->out[0], &len[0]);
+	if (!lzo_guard_ok(b->out[0] + out_len))
+		return 1;
+
+	/* The reference needs some input; a truncated marker is enough */
+	if (src_len < 3)
+		return ret[0] == LZO_E_OK ? 1 : ret[0];
+
+	ret[1] = ref_decompress(src, src_len, b->out[1], &len[1]);
+	if ((ret[0] == LZO_E_OK) != (ret[1] == LZO_E_OK))
+		return 1;
+	if (ret[0] == LZO_E_OK &&
+	    (len[0] != len[1] || memcmp(b->out[0], b->out[1], len[0])))
+		return 1;
+
+	return ret[0];
+}
+
+static int __init lzo_test_one(struct lzo_test_bufs *b, size_t len)
+{
+	size_t dst_len[2];
+	int i, ret;
+
+	dst_len[0] = dst_len[1] = lzo1x_worst_compress(len);
+	if (lzo1x_1_compress(b->src, len, b->dst[0], &dst_len[0], b->wrkmem) ||
+	    ref_compress(b->src, len, b->dst[1], &dst_len[1], b->ref_wrkmem))
+		return -EINVAL;
+	if (dst_len[0] > lzo1x_worst_compress(len))
+		return -EOVERFLOW;
+
+	for (i = 0; i < 2; i++) {
+		const unsigned char *dst = b->dst[i];
+		size_t n = dst_len[i];
+		int j;
+
+		/* Both decompressors must get the original back */
+		if (lzo_decompress_both(b, dst, n, len) != LZO_E_OK ||
+		    memcmp(b->out[0], b->src, len))
+			return -EILSEQ;
+
+		/* ... and agree on broken streams and short buffers */
+		if (len) {
+			ret = lzo_decompress_both(b, dst, n, len - 1);
+			if (ret != LZO_E_OUTPUT_OVERRUN)
+				return -EFAULT;
+		}
+		for (j = 0; j < 8; j++) {
+			ret = lzo_decompress_both(b, dst, lzo_rand() % n, len);
+			if (ret == 1 || ret == LZO_E_OK)
+				return -EFAULT;
+		}
+		for (j = 0; j < 8 && n > 3; j++) {
+			unsigned char *p = b->dst[i] + lzo_rand() % (n - 3);
+			unsigned char old = *p;
+
+			*p ^= 1 << (lzo_rand() % 8);
+			ret = lzo_decompress_both(b, dst, n, len);
+			*p = old;
+			if (ret == 1)
+				return -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+/* Throughput of both decompressors on the compressed text corpus */
+static void __init lzo_bench(struct lzo_test_bufs *b)
+{
+	size_t dst_len = lzo1x_worst_compress(LZO_TEST_MAX);
+	unsigned int mbs[2];
+	int i, j;
+
+	lzo_fill(b->src, LZO_TEST_MAX, LZO_TEXT);
+	lzo1x_1_compress(b->src, LZO_TEST_MAX, b->dst[0], &dst_len,
+			 b->wrkmem);
+
+	for (i = 0; i < 2; i++) {
+		ktime_t start = ktime_get();
+		s64 ns;
+
+		for (j = 0; j < 64; j++) {
+			size_t len = LZO_TEST_MAX;
+
+			if (i == 0)
+				lzo1x_decompress_safe(b->dst[0], dst_len,
+						      b->out[0], &len);
+			else
+				ref_decompress(b->dst[0], dst_len,
+					       b->out[1], &len);
+		}
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		mbs[i] = ns ? div64_u64((u64)64 * LZO_TEST_MAX * 1000, ns) : 0;
+	}
+
+	pr_info("test_lzo: decompression %u MB/s, reference %u MB/s\n",
+		mbs[0], mbs[1]);
+}
+
+static int __init test_lzo_init(void)
+{
+	size_t bufsize = lzo1x_worst_compress(LZO_TEST_MAX) + LZO_TEST_GUARD;
+	struct lzo_test_bufs b;
+	unsigned int tests = 0, failed = 0;
+	int i, kind, ret = -ENOMEM;
+
+	b.src = vmalloc(LZO_TEST_MAX);
+	b.dst[0] = vmalloc(bufsize);
+	b.dst[1] = vmalloc(bufsize);
+	b.out[0] = vmalloc(bufsize);
+	b.out[1] = vmalloc(bufsize);
+	b.wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	b.ref_wrkmem = vmalloc(REF_MEM_COMPRESS);
+	if (!b.src || !b.dst[0] || !b.dst[1] || !b.out[0] || !b.out[1] ||
+	    !b.wrkmem || !b.ref_wrkmem)
+		goto out;
+
+	lzo_seed = 1;
+	for (kind = 0; kind < LZO_NR_KINDS; kind++) {
+		for (i = 0; i < ARRAY_SIZE(lzo_test_lens); i++) {
+			size_t len = lzo_test_lens[i];
+
+			lzo_fill(b.src, len, kind);
+			ret = lzo_test_one(&b, len);
+			tests++;
+			if (ret) {
+				pr_err("test_lzo: %s, %zu bytes: failed (%d)\n",
+				       lzo_kind_names[kind], len, ret);
+				failed++;
+			}
+		}
+	}
+
+	if (failed) {
+		pr_err("test_lzo: %u of %u tests failed\n", failed, tests);
+		ret = -EINVAL;
+	} else {
+		pr_info("test_lzo: all %u tests passed\n", tests);
+		lzo_bench(&b);
+		ret = 0;
+	}
+
+out:
+	vfree(b.ref_wrkmem);
+	vfree(b.wrkmem);
+	vfree(b.out[1]);
+	vfree(b.out[0]);
+	vfree(b.dst[1]);
+	vfree(b.dst[0]);
+	vfree(b.src);
+	return ret;
+}
+
+static void __exit test_lzo_exit(void)
+{
+}
+
+module_init(test_lzo_init);
+module_exit(test_lzo_exit);
+
+MODULE_DESCRIPTION("LZO1X compressor and decompressor tests");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,227 @@
+/*
+ * logger-bench - write throughput benchmark for the Android logger
+ *
+ * Spawns N writer threads that hammer a log device (by default
+ * /dev/log/main) with log lines in the same format liblog uses, optionally
+ * with a reader draining the log at the same time, and reports the
+ * aggregate write rate.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2, as published
+ * by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define LOGGER_ENTRY_MAX_LEN	(4 * 1024)
+#define ANDROID_LOG_INFO	4
+
+static const char *device = "/dev/log/main";
+static unsigned int nr_threads = 4;
+static unsigned int seconds = 5;
+static size_t msg_len = 64;
+static int with_reader;
+
+static volatile int stop;
+
+struct writer {
+	pthread_t thread;
+	unsigned int id;
+	unsigned long long lines;
+	unsigned long long bytes;
+	unsigned long long errors;
+};
+
+static void *writer_fn(void *arg)
+{
+	struct writer *w = arg;
+	unsigned char prio = ANDROID_LOG_INFO;
+	char tag[32];
+	char *msg;
+	struct iovec vec[3];
+	int fd;
+
+	fd = open(device, O_WRONLY);
+	if (fd < 0) {
+		perror(device);
+		return NULL;
+	}
+
+	msg = malloc(msg_len + 1);
+	if (!msg) {
+		close(fd);
+		return NULL;
+	}
+	memset(msg, 'a' + w->id % 26, msg_len);
+	msg[msg_len] = '\0';
+	snprintf(tag, sizeof(tag), "bench%u", w->id);
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = tag;
+	vec[1].iov_len = strlen(tag) + 1;
+	vec[2].iov_base = msg;
+	vec[2].iov_len = msg_len + 1;
+
+	while (!stop) {
+		ssize_t ret = writev(fd, vec, 3);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			w->errors++;
+			continue;
+		}
+		w->lines++;
+		w->bytes += ret;
+	}
+
+	free(msg);
+	close(fd);
+	return NULL;
+}
+
+static unsigned long long reader_lines;
+
+static void *reader_fn(void *arg)
+{
+	char buf[LOGGER_ENTRY_MAX_LEN];
+	int fd;
+
+	(void)arg;
+
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(device);
+		return NULL;
+	}
+
+	while (!stop) {
+		ssize_t ret = read(fd, buf, sizeof(buf));
+
+		if (ret > 0)
+			reader_lines++;
+		else if (ret < 0 && errno == EAGAIN)
+			usleep(1000);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-d device] [-t threads] [-s seconds] [-l msglen] [-r]\n"
+		"  -d  log device to write to (default %s)\n"
+		"  -t  number of writer threads (default %u)\n"
+		"  -s  duration of the run in seconds (default %u)\n"
+		"  -l  payload length of each message (default %zu)\n"
+		"  -r  run a reader draining the log concurrently\n",
+		name, device, nr_threads, seconds, msg_len);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long lines = 0, bytes = 0, errors = 0;
+	struct writer *writers;
+	pthread_t reader;
+	double start, elapsed;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:s:l:rh")) != -1) {
+		switch (opt) {
+		case 'd':
+			device = optarg;
+			break;
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			msg_len = atoi(optarg);
+			break;
+		case 'r':
+			with_reader = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!nr_threads || !seconds || msg_len >= LOGGER_ENTRY_MAX_LEN)
+		usage(argv[0]);
+
+	writers = calloc(nr_threads, sizeof(*writers));
+	if (!writers) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (with_reader && pthread_create(&reader, NULL, reader_fn, NULL)) {
+		perror("pthread_create");
+		return 1;
+	}
+
+	start = now();
+	for (i = 0; i < nr_threads; i++) {
+		writers[i].id = i;
+		if (pthread_create(&writers[i].thread, NULL, writer_fn,
+				   &writers[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(writers[i].thread, NULL);
+		lines += writers[i].lines;
+		bytes += writers[i].bytes;
+		errors += writers[i].errors;
+	}
+	elapsed = now() - start;
+
+	if (with_reader)
+		pthread_join(reader, NULL);
+
+	printf("%s: %u threads, %zu byte messages, %.2f s\n",
+	       device, nr_threads, msg_len, elapsed);
+	printf("  %llu lines, %.0f lines/s, %.2f MB/s, %llu errors\n",
+	       lines, lines / elapsed, bytes / elapsed / (1024 * 1024), errors);
+	for (i = 0; i < nr_threads; i++)
+		printf("  thread %u: %.0f lines/s\n", i,
+		       writers[i].lines / elapsed);
+	if (with_reader)
+		printf("  reader: %llu lines\n", reader_lines);
+
+	free(writers);
+	return errors ? 1 : 0;
+}